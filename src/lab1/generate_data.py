@@ -1,14 +1,42 @@
 import os
+import struct
 import argparse
 import numpy as np
 
 
+DTYPES = {'float': (1, '<f4'), 'double': (2, '<f8'), 'int32': (3, '<i4'), 'int64': (4, '<i8')}
+
+
+def checksum(data):
+    # the same as matfile::checksum: two running sums of little-endian 64-bit words
+    data += b'\0' * (-len(data) % 8)
+    sums = np.cumsum(np.frombuffer(data, dtype='<u8'), dtype=np.uint64)
+    if len(sums) == 0:
+        return 0
+    return int(sums[-1]) ^ int(np.sum(sums, dtype=np.uint64))
+
+
+def save_binary(path, matrix, dtype):
+    # binary matrix file, see src/matfile/MatrixFile.h
+    code, np_dtype = DTYPES[dtype]
+    data = np.ascontiguousarray(matrix, dtype=np_dtype).tobytes()
+    header = struct.pack('<8sIIIIQQQ16x', b'MTPMATRX', 1, code, 0, 0,
+                         matrix.shape[0], matrix.shape[1], checksum(data))
+    with open(path, 'wb') as f:
+        f.write(header)
+        f.write(data)
+
+
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('--rows', '-r', type=int)
     parser.add_argument('--cols', '-c', type=int)
     parser.add_argument('--n-files', '-n', type=int)
     parser.add_argument('--dir', '-d', type=str)
+    parser.add_argument('--binary', '-b', action='store_true',
+                        help='write input matrices as binary files *.bin')
+    parser.add_argument('--dtype', '-t', choices=sorted(DTYPES), default='float',
+                        help='element type of binary files')
     args = parser.parse_args()
 
     shape = (args.rows, args.cols)
@@ -19,7 +47,10 @@ def main():
     for i in range(1, args.n_files+1):
         mat_summand = np.random.randint(0, 1000, shape, dtype=int)
         mat_sum += mat_summand
-        np.savetxt(os.path.join(args.dir, 'matrix{}.txt'.format(i)), mat_summand, fmt='%i')
+        if args.binary:
+            save_binary(os.path.join(args.dir, 'matrix{}.bin'.format(i)), mat_summand, args.dtype)
+        else:
+            np.savetxt(os.path.join(args.dir, 'matrix{}.txt'.format(i)), mat_summand, fmt='%i')
     np.savetxt(os.path.join(args.dir, 'target.txt'), mat_sum, fmt='%i')
 
 
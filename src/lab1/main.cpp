@@ -2,9 +2,13 @@
 #include <thread>
 #include <queue>
 #include <chrono>
+#include <algorithm>
+#include <unistd.h>
 
 #include "../cli-args/Parser.h"
 #include "tasks.h"
+#include "../matfile/MatrixFile.h"
+#include "../matfile/MatrixFileWriter.h"
 #include "../mt/TaskGraph.h"
 
 
@@ -24,6 +28,33 @@ unsigned getPositive(const cli::Arguments& args,
 }
 
 
+// input files must be readable; binary ones are read row by row as they are,
+// so they must also match given dimensions
+void checkInput(const cli::Parser &parser, const std::string &inName,
+                unsigned nRows, unsigned nCols) {
+    try {
+        if (!matfile::isMatrixFile(inName)) {
+            matfile::MappedFile file{inName};
+            return;
+        }
+        matfile::MappedMatrix matrix{inName};
+        if (matrix.getNRows() != nRows || matrix.getNCols() != nCols) {
+            parser.fail("in-names", inName + " has other dimensions", true);
+        }
+    } catch (const std::runtime_error &err) {
+        parser.fail("in-names", err.what(), true);
+    }
+}
+
+// Rows per block, so that the blocks of a reader, an adder and both its summands
+// stay in L2 cache together
+unsigned autoBlockRows(unsigned nRows, unsigned nCols) {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    size_t cacheBytes = l2 > 0 ? (size_t)l2 : 256 << 10;
+    size_t rows = cacheBytes / (4 * nCols * sizeof(float));
+    return (unsigned)std::max<size_t>(1, std::min<size_t>(rows, nRows));
+}
+
 int main(int argc, char **argv) {
     cli::Parser parser{"lab1", "Adds matrices from given files"};
     parser  .param("n-threads", "-n", "", "Number of threads")
@@ -31,17 +62,25 @@ int main(int argc, char **argv) {
             .param("cols", "-c", "", "Number of columns")
             .param("out-name", "-o", "", "Output file name")
             .flag("progress", "-pr", "Display progress")
+            .flag("binary-output", "-B", "Write output in binary format")
+            .param("block-rows", "-k", "?", "Rows passed between tasks at once, by default as many "
+                                            "as fit in L2 cache; 1 streams single rows")
+            .param("ring-depth", "-d", "?", "Blocks a task may produce ahead of its consumer (default 4)")
             .positional("in-names", "+");
     auto args = parser.parse(argc, argv);
     unsigned nWorkers = getPositive(args, parser, "n-threads");
     unsigned nRows = getPositive(args, parser, "rows");
     unsigned nCols = getPositive(args, parser, "cols");
+    unsigned blockRows = args.hasParam("block-rows") ? std::min(getPositive(args, parser, "block-rows"), nRows)
+                                                     : autoBlockRows(nRows, nCols);
+    unsigned ringDepth = args.hasParam("ring-depth") ? getPositive(args, parser, "ring-depth") : 4;
 
     std::queue<mt::Task*> tasks;
     mt::TaskGraph graph;
 
     for(const auto& inName : args.paramlist("in-names")) {
-        mt::Task *t = new lab1::RowReader(nRows, nCols, inName);
+        checkInput(parser, inName, nRows, nCols);
+        mt::Task *t = new lab1::RowReader(nRows, nCols, inName, blockRows, ringDepth);
         tasks.push(t);
         graph.addTask(t, {});
     }
@@ -51,12 +90,13 @@ int main(int argc, char **argv) {
         tasks.pop();
         mt::Task *right = tasks.front();
         tasks.pop();
-        mt::Task *sum = new lab1::RowAdder(nRows, nCols);
+        mt::Task *sum = new lab1::RowAdder(nRows, nCols, blockRows, ringDepth);
         graph.addTask(sum, {left, right});
         tasks.push(sum);
     }
     mt::Task *totalSum = tasks.front();
-    mt::Task *writer = new lab1::RowWriter(args.param("out-name"), nRows);
+    mt::Task *writer = new lab1::RowWriter(args.param("out-name"), nRows, args.flag("progress"),
+                                           args.flag("binary-output") ? matfile::BINARY : matfile::TEXT);
     graph.addTask(writer, {totalSum});
 
     using namespace std::chrono;
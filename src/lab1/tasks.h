@@ -2,10 +2,13 @@
 #define MTP_LAB1_TASKS_H
 
 #include "../mt/Task.h"
+#include "../matfile/MatrixFile.h"
+#include "../matfile/TextMatrix.h"
+#include "../matfile/MatrixFileWriter.h"
 #include <vector>
-#include <mutex>
+#include <atomic>
+#include <algorithm>
 #include <string>
-#include <fstream>
 #include <cassert>
 #include <iostream>
 
@@ -22,123 +25,118 @@ namespace lab1 {
 #endif
 
 
+// Block of up to a fixed number of rows
 class RowBuffer {
-    const size_t _size;
-    int _version;
-    mutable bool _allocateDone = false;
-    mutable std::vector<float> _data;
-    mutable bool _wasRead;
-    mutable std::mutex _mtx;
+    size_t _nCols;
+    // rows actually held, fewer than fit in the last block of a matrix
+    size_t _nRows;
+    std::vector<float> _data;
 
 public:
-    typedef std::vector<float>::const_iterator read_ptr;
-    typedef std::vector<float>::iterator write_ptr;
-
-    RowBuffer(size_t size)
-            : _size(size)
-//            , _data()
-            , _data(size, 0)
-            , _allocateDone(true)
-            , _version(0)
-            , _wasRead(true)
-            , _mtx()
+    RowBuffer(size_t nCols, size_t maxRows = 1)
+            : _nCols(nCols)
+            , _nRows(maxRows)
+            , _data(nCols * maxRows, 0)
     {}
 
-    read_ptr reader() const {
-        ensureAllocated();
-        return _data.cbegin();
+    const float* reader() const { return _data.data(); }
+    float* writer() { return _data.data(); }
+    size_t getNRows() const { return _nRows; }
+    size_t getNCols() const { return _nCols; }
+    void setNRows(size_t nRows) {
+        assert(nRows * _nCols <= _data.size());
+        _nRows = nRows;
     }
-    read_ptr end() const {
-        ensureAllocated();
-        return  _data.cend();
-    }
-    void readDone() const {
-        std::unique_lock<std::mutex> _lock{_mtx};
-        _wasRead = true;
-    }
-    bool wasRead() const {
-        std::unique_lock<std::mutex> _lock{_mtx};
-        return _wasRead;
-    }
-    int version() const { return _version; }
 
-    void swap(RowBuffer *other) {
-        // NOTE: perform this BEFORE locking, since these ops are also synchronized
-        ensureAllocated();
-        other->ensureAllocated();
+};
 
-        std::unique_lock<std::mutex> _lock{_mtx};
-        std::unique_lock<std::mutex> _othersLock{other->_mtx};
 
-        if (_data.size() != other->_data.size())
-            throw std::runtime_error("Cannot swap buffers of different size");
-        _data.swap(other->_data);
-        _version++;
-        _wasRead = false;
-    }
-    write_ptr writer() {
-        ensureAllocated();
-        return _data.begin();
+// Bounded queue of row blocks from one producing task to one consuming task. Blocks are
+// filled and read in place; the sides share only the counts of pushed and popped blocks,
+// so no locks are taken and the producer may run up to `depth` blocks ahead.
+class RowRing {
+    std::vector<RowBuffer> _slots;
+    std::atomic<size_t> _nPushed, _nPopped;
+
+public:
+    RowRing(size_t nCols, size_t maxRows, size_t depth)
+            : _slots(depth, RowBuffer(nCols, maxRows)), _nPushed(0), _nPopped(0) {}
+
+    bool isFull() const {
+        return _nPushed.load(std::memory_order_acquire) - _nPopped.load(std::memory_order_acquire)
+               == _slots.size();
     }
-    write_ptr end() {
-        ensureAllocated();
-        return  _data.end();
+    bool isEmpty() const {
+        return _nPushed.load(std::memory_order_acquire) == _nPopped.load(std::memory_order_acquire);
     }
 
-private:
+    // producer side: the block to fill next, nullptr if the ring is full
+    RowBuffer* writeSlot() {
+        size_t pushed = _nPushed.load(std::memory_order_relaxed);
+        if (pushed - _nPopped.load(std::memory_order_acquire) == _slots.size()) return nullptr;
+        return &_slots[pushed % _slots.size()];
+    }
+    void push() { _nPushed.store(_nPushed.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
 
-    void ensureAllocated() const {
-//        std::unique_lock<std::mutex> _lock{_mtx};
-//        if (!_allocateDone) {
-//            _data.resize(_size, 0);
-//            _allocateDone = true;
-//        }
+    // consumer side: the oldest block, nullptr if the ring is empty
+    const RowBuffer* readSlot() const {
+        size_t popped = _nPopped.load(std::memory_order_relaxed);
+        if (_nPushed.load(std::memory_order_acquire) == popped) return nullptr;
+        return &_slots[popped % _slots.size()];
     }
+    void pop() { _nPopped.store(_nPopped.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
 
 };
 
 
+// Produces a matrix in blocks of blockRows rows, one block per portion, into a ring read
+// by a single consumer; bigger blocks spread the cost of scheduling over more elements
 class RowProducer : public mt::Task {
 
 public:
-    RowProducer(size_t nRows, size_t nCols) : _nRows(nRows), _nCols(nCols) {}
+    RowProducer(size_t nRows, size_t nCols, size_t blockRows = 1, size_t ringDepth = 2)
+            : _out(nullptr), _nRows(nRows), _nCols(nCols), _blockRows(blockRows), _ringDepth(ringDepth) {}
 
-    const RowBuffer* getOutBuffer() const { return _outBuffer; }
+    RowRing* getOutput() const { return _out; }
 
 protected:
-    RowBuffer *_outBuffer;
+    RowRing *_out;
     size_t _nRowsProduced;
-    const size_t _nRows, _nCols;
+    const size_t _nRows, _nCols, _blockRows, _ringDepth;
 
     virtual bool doStart(const std::vector<mt::Task*>& dependencies) override {
-        prepareInternalBuffers(dependencies);
-        _outBuffer = new RowBuffer(_nCols);
+        prepareInputs(dependencies);
         _nRowsProduced = 0;
+        _out = new RowRing(_nCols, _blockRows, _ringDepth);
         return false;
     }
 
     virtual bool isWaiting() override {
-        return !hasNextBuffer() || !_outBuffer->wasRead();
+        return _out->isFull() || !hasNextInput();
     }
 
     virtual bool doWorkPortion() override {
-        auto nextBuf = getNextBuffer();
-        if (nextBuf == nullptr|| !_outBuffer->wasRead())
+        RowBuffer *block = _out->writeSlot();
+        if (block == nullptr || !hasNextInput())
             return false; // this should never happen
-        _outBuffer->swap(nextBuf);
-        _nRowsProduced++;
+        block->setNRows(std::min(_blockRows, _nRows - _nRowsProduced));
+        produce(block);
+        _nRowsProduced += block->getNRows();
+        _out->push();
         return _nRowsProduced >= _nRows;
     }
 
     virtual void doFinalize() override {
-        delete _outBuffer;
-        destroyInternalBuffers();
+        delete _out;
+        _out = nullptr;
+        destroyInputs();
     }
 
-    virtual void prepareInternalBuffers(const std::vector<mt::Task *> &dependencies) = 0;
-    virtual void destroyInternalBuffers() = 0;
-    virtual RowBuffer* getNextBuffer() = 0;
-    virtual bool hasNextBuffer() = 0;
+    virtual void prepareInputs(const std::vector<mt::Task *> &dependencies) = 0;
+    virtual void destroyInputs() = 0;
+    virtual bool hasNextInput() = 0;
+    // fills the rows of the block starting from _nRowsProduced
+    virtual void produce(RowBuffer *block) = 0;
 
 };
 
@@ -146,89 +144,97 @@ protected:
 class RowReader : public RowProducer {
 
     const std::string& filename;
-    RowBuffer *_readBuffer;
-    std::ifstream *_inFile;
+    // one of them is set, depending on the format of the file
+    matfile::TextMatrixReader *_textReader;
+    matfile::MappedMatrix *_mapped;
 
 public:
-    RowReader(size_t nRows, size_t nCols, const std::string& filename)
-            : RowProducer(nRows, nCols), filename(filename) {}
+    RowReader(size_t nRows, size_t nCols, const std::string& filename, size_t blockRows = 1,
+              size_t ringDepth = 2)
+            : RowProducer(nRows, nCols, blockRows, ringDepth), filename(filename) {}
 
 protected:
 
-    virtual void prepareInternalBuffers(const std::vector<mt::Task *> &dependencies) override {
+    virtual void prepareInputs(const std::vector<mt::Task *> &dependencies) override {
         assert(dependencies.size() == 0);
-        _readBuffer = new RowBuffer(_nCols);
-        _inFile = new std::ifstream(filename);
+        _textReader = nullptr;
+        _mapped = nullptr;
+        if (matfile::isMatrixFile(filename)) {
+            _mapped = new matfile::MappedMatrix(filename);
+        } else {
+            _textReader = new matfile::TextMatrixReader(filename);
+        }
     }
-    virtual void destroyInternalBuffers() override {
-        delete _readBuffer;
-        _inFile->close();
-        delete _inFile;
+    virtual void destroyInputs() override {
+        delete _textReader;
+        delete _mapped;
     }
-    virtual bool hasNextBuffer() override {
+    virtual bool hasNextInput() override {
         return true;
     }
-    virtual RowBuffer* getNextBuffer() override {
+    virtual void produce(RowBuffer *block) override {
         lab1_debug("start read #" << _nRowsProduced+1 << " by " << getId());
-        for(auto it = _readBuffer->writer(); it != _readBuffer->end(); it++) {
-            *_inFile >> *it;
+        if (_mapped != nullptr) {
+            _mapped->copyRows(block->writer(), _nRowsProduced, block->getNRows());
+        } else {
+            try {
+                _textReader->read(block->writer(), block->getNRows() * _nCols);
+            } catch (const std::runtime_error &err) {
+                std::cerr << err.what() << std::endl;
+            }
         }
         lab1_debug("done  read #" << _nRowsProduced+1 << " by " << getId());
-        return _readBuffer;
     }
 };
 
 
 class RowAdder : public RowProducer {
-    RowBuffer *_sumBuffer;
     const RowProducer *_summand1Prod, *_summand2Prod;
 
 public:
-    RowAdder(size_t nRows, size_t nCols)
-            : RowProducer(nRows, nCols) {}
+    RowAdder(size_t nRows, size_t nCols, size_t blockRows = 1, size_t ringDepth = 2)
+            : RowProducer(nRows, nCols, blockRows, ringDepth) {}
 
 protected:
 
     virtual bool isWaiting() override {
-        if (_summand1Prod->getOutBuffer() == nullptr ||
-                _summand2Prod->getOutBuffer() == nullptr) {
+        if (_summand1Prod->getOutput() == nullptr ||
+                _summand2Prod->getOutput() == nullptr) {
             return true;
         }
         return RowProducer::isWaiting();
     }
 
-    virtual void prepareInternalBuffers(const std::vector<mt::Task *> &dependencies) override {
+    virtual void prepareInputs(const std::vector<mt::Task *> &dependencies) override {
         assert(dependencies.size() == 2);
         _summand1Prod = dynamic_cast<RowProducer*>(dependencies[0]);
         _summand2Prod = dynamic_cast<RowProducer*>(dependencies[1]);
         assert(_summand1Prod != nullptr);
         assert(_summand2Prod != nullptr);
-
-        _sumBuffer = new RowBuffer(_nCols);
     }
-    virtual void destroyInternalBuffers() override {
-        delete _sumBuffer;
+    virtual void destroyInputs() override {
         _summand1Prod = nullptr;
         _summand2Prod = nullptr;
     }
-    virtual bool hasNextBuffer() override {
-        return !_summand1Prod->getOutBuffer()->wasRead() && !_summand2Prod->getOutBuffer()->wasRead();
+    virtual bool hasNextInput() override {
+        return !_summand1Prod->getOutput()->isEmpty() && !_summand2Prod->getOutput()->isEmpty();
     }
-    virtual RowBuffer* getNextBuffer() override {
+    virtual void produce(RowBuffer *block) override {
         lab1_debug("start sum  #" << _nRowsProduced+1 << " by " << getId()
                    << " from " << _summand1Prod->getId() << " and " << _summand2Prod->getId());
-        auto sum = _sumBuffer->writer();
-        auto summand1 = _summand1Prod->getOutBuffer()->reader(),
-             summand2 = _summand2Prod->getOutBuffer()->reader();
-        while(sum != _sumBuffer->end()) {
-            *sum = *summand1 + *summand2;
-            ++sum; ++summand1; ++summand2;
+        RowRing *in1 = _summand1Prod->getOutput(), *in2 = _summand2Prod->getOutput();
+        const RowBuffer *summands1 = in1->readSlot(), *summands2 = in2->readSlot();
+        assert(summands1->getNRows() == block->getNRows());
+        assert(summands2->getNRows() == block->getNRows());
+        float *sum = block->writer();
+        const float *summand1 = summands1->reader(), *summand2 = summands2->reader();
+        for (size_t i = 0; i < block->getNRows() * _nCols; i++) {
+            sum[i] = summand1[i] + summand2[i];
         }
-        _summand1Prod->getOutBuffer()->readDone();
-        _summand2Prod->getOutBuffer()->readDone();
+        in1->pop();
+        in2->pop();
         lab1_debug("done  sum  #" << _nRowsProduced+1 << " by " << getId()
                    << " from " << _summand1Prod->getId() << " and " << _summand2Prod->getId());
-        return _sumBuffer;
     }
 
 };
@@ -238,14 +244,16 @@ class RowWriter : public mt::Task {
     const std::string& filename;
     const size_t _nRows;
     const bool _progress;
+    const matfile::Format _format;
 
     const RowProducer *_sourceProducer;
-    std::ofstream *_outFile;
+    matfile::MatrixFileWriter *_outFile;
     size_t _wroteRows;
 
 public:
-    RowWriter(const std::string& filename, const size_t nRows, bool progress=false)
-            : filename(filename), _nRows(nRows), _progress(progress) {}
+    RowWriter(const std::string& filename, const size_t nRows, bool progress=false,
+              matfile::Format format=matfile::TEXT)
+            : filename(filename), _nRows(nRows), _progress(progress), _format(format) {}
 
 protected:
 
@@ -253,26 +261,30 @@ protected:
         assert(dependencies.size() == 1);
         _sourceProducer = dynamic_cast<RowProducer*>(dependencies[0]);
         assert(_sourceProducer != nullptr);
-        _outFile = new std::ofstream(filename);
+        _outFile = new matfile::MatrixFileWriter(filename, _format);
         _wroteRows = 0;
         return false;
     }
 
     virtual bool isWaiting() override {
-        if (_sourceProducer->getOutBuffer() == nullptr) return true;
-        return _sourceProducer->getOutBuffer()->wasRead();
+        if (_sourceProducer->getOutput() == nullptr) return true;
+        return _sourceProducer->getOutput()->isEmpty();
     }
 
     virtual bool doWorkPortion() override {
-        auto src = _sourceProducer->getOutBuffer();
-        for(auto it = src->reader(); it != src->end(); it++) {
-            *_outFile << *it << ' ';
+        RowRing *in = _sourceProducer->getOutput();
+        const RowBuffer *src = in->readSlot();
+        if (src == nullptr) return false; // this should never happen
+        size_t nRows = src->getNRows(), nCols = src->getNCols();
+        try {
+            _outFile->writeRows(src->reader(), nRows, nCols, nCols);
+        } catch (const std::runtime_error &err) {
+            std::cerr << err.what() << std::endl;
         }
-        *_outFile << std::endl;
-        src->readDone();
-        _wroteRows++;
+        _wroteRows += nRows;
+        in->pop();
         if (_progress) {
-            if (_wroteRows > 1) std::cout << '\r';
+            if (_wroteRows > nRows) std::cout << '\r';
             std::cout << _wroteRows << '/' << _nRows;
             if (_wroteRows >= _nRows) std::cout << std::endl;
             std::cout.flush();
@@ -283,7 +295,11 @@ protected:
 
     virtual void doFinalize() override {
         _sourceProducer = nullptr;
-        _outFile->close();
+        try {
+            _outFile->close();
+        } catch (const std::runtime_error &err) {
+            std::cerr << err.what() << std::endl;
+        }
         delete _outFile;
     }
 
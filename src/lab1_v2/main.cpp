@@ -2,9 +2,16 @@
 #include <thread>
 #include <queue>
 #include <chrono>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <functional>
 
 #include "../cli-args/Parser.h"
 #include "tasks.h"
+#include "../matfile/MatrixFile.h"
+#include "../matfile/MatrixFileWriter.h"
+#include "../matfile/ResultCache.h"
 #include "../mt/TaskGraph.h"
 
 
@@ -24,6 +31,51 @@ unsigned getPositive(const cli::Arguments& args,
 }
 
 
+// input files must be readable; binary ones are read row by row as they are,
+// so they must also match given dimensions
+void checkInput(const cli::Parser &parser, const std::string &inName,
+                unsigned nRows, unsigned nCols) {
+    try {
+        if (!matfile::isMatrixFile(inName)) {
+            matfile::MappedFile file{inName};
+            return;
+        }
+        matfile::MappedMatrix matrix{inName};
+        if (matrix.getNRows() != nRows || matrix.getNCols() != nCols) {
+            parser.fail("in-names", inName + " has other dimensions", true);
+        }
+    } catch (const std::runtime_error &err) {
+        parser.fail("in-names", err.what(), true);
+    }
+}
+
+// Term of the pairwise summation: an input file or a sum of two other terms
+struct SumTerm {
+    std::vector<size_t> inputs;
+    int left, right;
+};
+
+// Sum of all input files and the terms it is made of, paired as they come from a queue
+std::vector<SumTerm> planSum(size_t nInputs) {
+    std::vector<SumTerm> terms;
+    std::queue<size_t> queue;
+    for (size_t i = 0; i < nInputs; i++) {
+        terms.push_back({{i}, -1, -1});
+        queue.push(i);
+    }
+    while (queue.size() > 1) {
+        size_t left = queue.front();
+        queue.pop();
+        size_t right = queue.front();
+        queue.pop();
+        SumTerm sum{terms[left].inputs, (int)left, (int)right};
+        sum.inputs.insert(sum.inputs.end(), terms[right].inputs.begin(), terms[right].inputs.end());
+        terms.push_back(sum);
+        queue.push(terms.size() - 1);
+    }
+    return terms;
+}
+
 int main(int argc, char **argv) {
     cli::Parser parser{"lab1", "Adds matrices from given files"};
     parser  .param("n-threads", "-n", "", "Number of threads")
@@ -31,32 +83,86 @@ int main(int argc, char **argv) {
             .param("cols", "-c", "", "Number of columns")
             .param("out-name", "-o", "", "Output file name")
             .flag("progress", "-pr", "Display progress")
+            .flag("binary-output", "-B", "Write output in binary format")
+            .param("cache-dir", "-K", "?", "Reuse sums of the same input files, keeping them in given directory")
+            .param("cache-size", "-k", "?", "Size limit of the cache in MiB, over which least recently used "
+                                           "sums are evicted (default 1024)")
             .positional("in-names", "+");
     auto args = parser.parse(argc, argv);
     unsigned nWorkers = getPositive(args, parser, "n-threads");
     unsigned nRows = getPositive(args, parser, "rows");
     unsigned nCols = getPositive(args, parser, "cols");
 
-    std::queue<mt::Task*> tasks;
-    mt::TaskGraph graph;
+    const std::vector<std::string> &inNames = args.paramlist("in-names");
+    for (const auto &inName : inNames) {
+        checkInput(parser, inName, nRows, nCols);
+    }
 
-    for(const auto& inName : args.paramlist("in-names")) {
-        mt::Task *t = new lab1_v2::FileReader(inName, nRows, nCols);
-        tasks.push(t);
-        graph.addTask(t, {});
+    std::unique_ptr<matfile::ResultCache> cache;
+    if (args.hasParam("cache-size") && !args.hasParam("cache-dir")) {
+        parser.fail("cache-size", "requires cache-dir", true);
+    }
+    // Sums are cached under the keys of the two terms they add, in sorted order as addition
+    // is commutative. Float addition is not associative, so the whole pairing is part of
+    // the key and a sum of the same files grouped differently is computed anew.
+    std::vector<std::string> keys(inNames.size());
+    if (args.hasParam("cache-dir")) {
+        size_t cacheSize = args.hasParam("cache-size") ? getPositive(args, parser, "cache-size") : 1024;
+        try {
+            cache.reset(new matfile::ResultCache(args.param("cache-dir"), cacheSize << 20));
+            for (size_t i = 0; i < inNames.size(); i++) {
+                std::stringstream ss;
+                ss << nRows << 'x' << nCols << ' ' << matfile::ResultCache::keyOfFile(inNames[i]);
+                keys[i] = matfile::ResultCache::keyOf(ss.str());
+            }
+        } catch (const std::runtime_error &err) {
+            parser.fail("cache-dir", err.what(), true);
+        }
     }
 
-    while (tasks.size() > 1) {
-        mt::Task *left = tasks.front();
-        tasks.pop();
-        mt::Task *right = tasks.front();
-        tasks.pop();
-        mt::Task *sum = new lab1_v2::MatrixSummator(nRows, nCols);
-        graph.addTask(sum, {left, right});
-        tasks.push(sum);
+    mt::TaskGraph graph;
+    std::vector<SumTerm> terms = planSum(inNames.size());
+    // terms come after those they are made of
+    std::vector<std::string> termKeys(terms.size());
+    for (size_t i = 0; cache != nullptr && i < terms.size(); i++) {
+        const SumTerm &term = terms[i];
+        if (term.left < 0) {
+            termKeys[i] = keys[term.inputs[0]];
+            continue;
+        }
+        std::string leftKey = termKeys[term.left], rightKey = termKeys[term.right];
+        if (rightKey < leftKey) std::swap(leftKey, rightKey);
+        termKeys[i] = matfile::ResultCache::keyOf("float sum of " + leftKey + ' ' + rightKey);
     }
-    mt::Task *totalSum = tasks.front();
-    mt::Task *writer = new lab1_v2::FileWriter(args.param("out-name"), nRows, nCols);
+    size_t nHits = 0;
+    // terms found in the cache are read from there with nothing they are made of
+    std::function<mt::Task*(size_t)> defineTerm = [&] (size_t i) -> mt::Task* {
+        const SumTerm &term = terms[i];
+        std::string key;
+        if (term.left >= 0 && cache != nullptr) {
+            key = termKeys[i];
+            std::string path = cache->lookup(key);
+            if (!path.empty()) {
+                nHits++;
+                mt::Task *t = new lab1_v2::FileReader(path, nRows, nCols, nWorkers);
+                graph.addTask(t, {});
+                return t;
+            }
+        }
+        if (term.left < 0) {
+            mt::Task *t = new lab1_v2::FileReader(inNames[term.inputs[0]], nRows, nCols, nWorkers);
+            graph.addTask(t, {});
+            return t;
+        }
+        mt::Task *left = defineTerm(term.left), *right = defineTerm(term.right);
+        mt::Task *sum = new lab1_v2::MatrixSummator(nRows, nCols, cache.get(), key);
+        graph.addTask(sum, {left, right});
+        return sum;
+    };
+    mt::Task *totalSum = defineTerm(terms.size() - 1);
+    mt::Task *writer = new lab1_v2::FileWriter(args.param("out-name"), nRows, nCols,
+                                               args.flag("binary-output") ? matfile::BINARY : matfile::TEXT,
+                                               nWorkers);
     graph.addTask(writer, {totalSum});
 
     using namespace std::chrono;
@@ -65,6 +171,7 @@ int main(int argc, char **argv) {
     milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
     auto dur = end-start;
     std::cout << "time: " << dur.count()/1000.0 << "s" << std::endl;
+    if (cache != nullptr) std::cout << "cache: " << nHits << " hits" << std::endl;
 
     return 0;
 }
\ No newline at end of file
@@ -2,11 +2,15 @@
 #define MTP_LAB1_TASKS_H
 
 #include "../mt/Task.h"
+#include "../matfile/MatrixFile.h"
+#include "../matfile/TextMatrix.h"
+#include "../matfile/MatrixFileWriter.h"
+#include "../matfile/ResultCache.h"
 #include <vector>
 #include <mutex>
 #include <string>
-#include <fstream>
 #include <cassert>
+#include <iostream>
 
 
 namespace lab1_v2 {
@@ -66,12 +70,14 @@ protected:
 class FileReader : public MatrixProducer {
 
     const std::string _filename;
+    const unsigned _nParseThreads;
 
 public:
 
+    // text files are parsed on up to nParseThreads threads
     FileReader(const std::string &filename,
-               const size_t nRows, const size_t nCols)
-            : _filename(filename), MatrixProducer(nRows, nCols) {}
+               const size_t nRows, const size_t nCols, const unsigned nParseThreads = 1)
+            : _filename(filename), _nParseThreads(nParseThreads), MatrixProducer(nRows, nCols) {}
 
 protected:
 
@@ -80,9 +86,14 @@ protected:
             auto v = new std::vector<float>(_nRows*_nCols, 0);
             _data = v;
         }
-        std::ifstream file{_filename};
-        for(auto it = _data->begin(); it != _data->end(); it++) {
-            file >> *it;
+        if (matfile::isMatrixFile(_filename)) {
+            matfile::MappedMatrix{_filename}.copyRows(_data->data(), 0, _nRows);
+            return true;
+        }
+        try {
+            matfile::TextMatrixReader{_filename}.readAll(_data->data(), _data->size(), _nParseThreads);
+        } catch (const std::runtime_error &err) {
+            std::cerr << err.what() << std::endl;
         }
         return true;
     }
@@ -92,10 +103,15 @@ protected:
 
 class MatrixSummator : public MatrixProducer {
 
+    matfile::ResultCache *_cache;
+    const std::string _key;
+
 public:
 
-    MatrixSummator(const size_t nRows, const size_t nCols)
-            : MatrixProducer(nRows, nCols) {}
+    // with a cache, the sum is stored there under given key
+    MatrixSummator(const size_t nRows, const size_t nCols,
+                   matfile::ResultCache *cache = nullptr, const std::string &key = "")
+            : _cache(cache), _key(key), MatrixProducer(nRows, nCols) {}
 
 protected:
 
@@ -112,35 +128,55 @@ protected:
                 }
             }
         }
+        // stored before consumers take the data over
+        if (_cache != nullptr) store();
         return true;
     }
 
+private:
+
+    void store() {
+        std::string tempPath = _cache->getTempPath(_key);
+        try {
+            matfile::writeMatrixFile(tempPath, _nRows, _nCols, matfile::FLOAT32, _data->data());
+        } catch (const std::runtime_error &err) {
+            std::cerr << err.what() << std::endl;
+            _cache->discard(tempPath);
+            return;
+        }
+        _cache->insert(_key, tempPath);
+    }
+
 };
 
 class FileWriter : public MatrixProducer {
 
     const std::string _filename;
+    const matfile::Format _format;
+    const unsigned _nFormatThreads;
 
 public:
 
+    // text is formatted on up to nFormatThreads threads
     FileWriter(const std::string &filename,
-               const size_t nRows, const size_t nCols)
-            : _filename(filename), MatrixProducer(nRows, nCols) {}
+               const size_t nRows, const size_t nCols,
+               const matfile::Format format = matfile::TEXT, const unsigned nFormatThreads = 1)
+            : _filename(filename), _format(format), _nFormatThreads(nFormatThreads),
+              MatrixProducer(nRows, nCols) {}
 
 protected:
 
     virtual bool doWorkPortion() {
 
         assert(_dep_producers.size() == 1);
-        std::ofstream file{_filename};
         auto data = _dep_producers[0]->_data;
-        for(size_t row = 0; row < _nRows; row++) {
-            for(size_t col = 0; col < _nCols; col++) {
-                file << data->at(row*_nRows + col) << ' ';
-            }
-            file << '\n';
+        try {
+            matfile::MatrixFileWriter file{_filename, _format};
+            file.writeRows(data->data(), _nRows, _nCols, _nCols, _nFormatThreads);
+            file.close();
+        } catch (const std::runtime_error &err) {
+            std::cerr << err.what() << std::endl;
         }
-        file.close();
         return true;
     }
 
@@ -1,16 +1,70 @@
 #include "MatrixBuffer.h"
+#include "MatrixExpr.h"
+#include "kernels.h"
+#include "dtypes.h"
+#include "../matfile/MappedFile.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
 
-float& lab2::MatrixBuffer::at(size_t row, size_t col) {
+template <class T>
+T& lab2::MatrixBuffer<T>::at(size_t row, size_t col) {
     checkAllocated(*this);
-    return _data[row*_nCols + col];
+    return _elements[row*_nCols + col];
 }
 
-const float &lab2::MatrixBuffer::at(size_t row, size_t col) const {
+template <class T>
+const T &lab2::MatrixBuffer<T>::at(size_t row, size_t col) const {
     checkAllocated(*this);
-    return _data[row*_nCols + col];
+    return _elements[row*_nCols + col];
 }
 
-bool lab2::MatrixBuffer::allocate() {
+template <class T>
+lab2::MatrixView<T> lab2::MatrixBuffer<T>::view() {
+    checkAllocated(*this);
+    resetNonzeroBox();
+    return MatrixView<T>(_elements, _nRows, _nCols);
+}
+
+template <class T>
+lab2::ConstMatrixView<T> lab2::MatrixBuffer<T>::view() const {
+    checkAllocated(*this);
+    return ConstMatrixView<T>(_elements, _nRows, _nCols);
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::shrinkNonzeroBox() {
+    checkAllocated(*this);
+    NonzeroBox box = NonzeroBox::empty();
+    for (size_t r = 0; r < _nRows; r++) {
+        const T *row = _elements + r*_nCols;
+        size_t first = 0, last = _nCols;
+        while (first < _nCols && row[first] == 0) first++;
+        if (first == _nCols) continue;
+        while (row[last-1] == 0) last--;
+        box = box.unite({r, r+1, first, last});
+    }
+    _nonzero = box;
+}
+
+template <class T>
+size_t lab2::MatrixBuffer<T>::countNonzeros() const {
+    checkAllocated(*this);
+    size_t count = 0;
+    for (size_t r = _nonzero.rowBegin; r < _nonzero.rowEnd; r++) {
+        const T *row = _elements + r*_nCols;
+        for (size_t c = _nonzero.colBegin; c < _nonzero.colEnd; c++) {
+            count += row[c] != 0;
+        }
+    }
+    return count;
+}
+
+template <class T>
+bool lab2::MatrixBuffer<T>::allocate() {
     if (isAllocated())
         return true;
     try{
@@ -18,55 +72,153 @@ bool lab2::MatrixBuffer::allocate() {
     } catch (const std::bad_alloc&) {
         return false;
     }
+    _elements = _data.data();
+    _nonzero = NonzeroBox::empty();
     return true;
 }
 
-bool lab2::MatrixBuffer::isAllocated() const {
-    return !_data.empty();
+template <class T>
+bool lab2::MatrixBuffer<T>::isAllocated() const {
+    return _elements != nullptr;
 }
 
-void lab2::MatrixBuffer::free() {
+template <class T>
+void lab2::MatrixBuffer<T>::free() {
     _data.clear();
     _data.shrink_to_fit();
+    _elements = nullptr;
+    _owner.reset();
+    _nonzero = NonzeroBox::empty();
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::attach(T *data, const std::shared_ptr<void> &owner) {
+    free();
+    _elements = data;
+    _owner = owner;
+    resetNonzeroBox();
 }
 
-void lab2::MatrixBuffer::add(const lab2::MatrixBuffer &m, float coeff) {
+template <class T>
+bool lab2::MatrixBuffer<T>::spill(const std::string &path) {
+    if (!isAllocated() || isExternal() || getTotalSize() == 0) return false;
+    std::shared_ptr<matfile::MappedFile> file;
+    {
+        std::ofstream out{path, std::ios::binary};
+        out.write(reinterpret_cast<const char*>(_elements), (std::streamsize)(getTotalSize()*sizeof(T)));
+        out.close();
+        if (!out) {
+            std::remove(path.c_str());
+            return false;
+        }
+    }
+    try {
+        file = std::make_shared<matfile::MappedFile>(path, true);
+    } catch (const std::runtime_error&) {
+        std::remove(path.c_str());
+        return false;
+    }
+    std::remove(path.c_str());
+    NonzeroBox nonzero = _nonzero;
+    attach(reinterpret_cast<T*>(file->getData()), file);
+    _nonzero = nonzero;
+    return true;
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::prefetch() const {
+    if (!isAllocated() || !isExternal()) return;
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(_elements) / pageSize * pageSize;
+    uintptr_t end = reinterpret_cast<uintptr_t>(_elements + getTotalSize());
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::add(const lab2::MatrixBuffer<T> &m, T coeff) {
     checkSize(*this, m);
     checkAllocated(*this);
     checkAllocated(m);
-    for(size_t i = 0; i < _data.size(); i++) {
-        _data[i] += coeff * m._data[i];
-    }
+    if (m.isZero()) return;
+    MatrixView<T> dst = blockView(m._nonzero);
+    kernels::sum<T>(dst, dst, m.blockView(m._nonzero), coeff);
+    _nonzero = _nonzero.unite(m._nonzero);
 }
 
-void lab2::MatrixBuffer::sum(const lab2::MatrixBuffer &m1, const lab2::MatrixBuffer &m2, float coeff) {
-    checkAllocated(*this);
-    set(m1);
-    add(m2, coeff);
+template <class T>
+void lab2::MatrixBuffer<T>::sum(const lab2::MatrixBuffer<T> &m1, const lab2::MatrixBuffer<T> &m2, T coeff) {
+    *this = m1 + coeff*m2;
 }
 
-void lab2::MatrixBuffer::mul(const lab2::MatrixBuffer &m1, const lab2::MatrixBuffer &m2) {
-    if (m1._nCols != m2._nRows) {
-        throw std::runtime_error("Bad dimensions for matmul");
-    }
-    checkSize(*this, m1);
-    checkSize(*this, m2);
-    checkAllocated(m1);
-    checkAllocated(m2);
+template <class T>
+void lab2::MatrixBuffer<T>::combine(const std::vector<lab2::MatrixBuffer<T>*> &terms,
+                                    const std::vector<T> &coeffs) {
     checkAllocated(*this);
+    // zero terms are dropped, the rest are combined over the union of their nonzero boxes
+    NonzeroBox box = NonzeroBox::empty();
+    std::vector<const MatrixBuffer*> nonzeroTerms;
+    std::vector<T> nonzeroCoeffs;
+    for (size_t i = 0; i < terms.size(); i++) {
+        checkSize(*this, *terms[i]);
+        checkAllocated(*terms[i]);
+        if (terms[i]->isZero() || coeffs[i] == 0) continue;
+        box = box.unite(terms[i]->_nonzero);
+        nonzeroTerms.push_back(terms[i]);
+        nonzeroCoeffs.push_back(coeffs[i]);
+    }
+    fillZero(_nonzero);
+    _nonzero = box;
+    if (box.isEmpty()) return;
+    std::vector<ConstMatrixView<T>> views;
+    for (auto term : nonzeroTerms) views.push_back(term->blockView(box));
+    kernels::combine<T>(blockView(box), views, nonzeroCoeffs);
+}
 
-    for (size_t r = 0; r < _nRows; r++) {
-        for (size_t c = 0; c < _nCols; c++) {
-            at(r, c) = 0;
-            for (size_t i = 0; i < _nCols; i++) {
-                at(r, c) += m1.at(r, i) * m2.at(i, c);
-            }
-        }
+template <class T>
+void lab2::MatrixBuffer<T>::mul(const lab2::MatrixBuffer<T> &m1, const lab2::MatrixBuffer<T> &m2) {
+    mul(m1, m2, kernels::mul<T>);
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::mul(const lab2::MatrixBuffer<T> &m1, const lab2::MatrixBuffer<T> &m2,
+                             const kernels::MulFunction<T> &kernel) {
+    NonzeroBox result, inner;
+    if (!prepareProduct(m1, m2, result, inner)) return;
+    kernel(blockView(result),
+           m1.blockView({result.rowBegin, result.rowEnd, inner.colBegin, inner.colEnd}),
+           m2.blockView({inner.colBegin, inner.colEnd, result.colBegin, result.colEnd}));
+    _nonzero = result;
+}
+
+template <class T>
+bool lab2::MatrixBuffer<T>::pack(std::vector<T> &packed) const {
+    checkAllocated(*this);
+    try {
+        packed.resize(_nonzero.getNRows() * _nonzero.getNCols());
+    } catch (const std::bad_alloc&) {
+        return false;
     }
+    kernels::pack<T>(packed.data(), blockView(_nonzero));
+    return true;
+}
 
+template <class T>
+void lab2::MatrixBuffer<T>::mulPacked(const lab2::MatrixBuffer<T> &m1, const lab2::MatrixBuffer<T> &m2,
+                                      const std::vector<T> &packed2) {
+    NonzeroBox result, inner;
+    if (!prepareProduct(m1, m2, result, inner)) return;
+    MatrixView<T> dst = blockView(result);
+    kernels::fill<T>(dst, 0);
+    // packed2 holds the whole nonzero box of m2, of which only the inner rows are used
+    kernels::mulAddPacked<T>(dst,
+                             m1.blockView({result.rowBegin, result.rowEnd, inner.colBegin, inner.colEnd}),
+                             packed2.data(), m2._nonzero.getNRows(),
+                             inner.colBegin - m2._nonzero.rowBegin);
+    _nonzero = result;
 }
 
-void lab2::MatrixBuffer::set(const lab2::MatrixBuffer &m,
+template <class T>
+void lab2::MatrixBuffer<T>::set(const lab2::MatrixBuffer<T> &m,
                              size_t rowOffs, size_t colOffs,
                              size_t srcRowOffs, size_t srcColOffs,
                              size_t nRows, size_t nCols) {
@@ -75,11 +227,21 @@ void lab2::MatrixBuffer::set(const lab2::MatrixBuffer &m,
     if (_nRows < nRows+rowOffs || _nCols < nCols+colOffs) {
         throw std::runtime_error("Argument matrix does not fit into this matrix at given offset");
     }
-    for (size_t r = 0; r < nRows; r++) {
-        for (size_t c = 0; c < nCols; c++) {
-            at(r+rowOffs, c+colOffs) = m.at(r+srcRowOffs, c+srcColOffs);
-        }
+    checkAllocated(*this);
+    checkAllocated(m);
+
+    // clear whatever was in the target region, then copy only the nonzero part of the source
+    NonzeroBox target{rowOffs, rowOffs + nRows, colOffs, colOffs + nCols};
+    fillZero(_nonzero.intersect(target));
+    NonzeroBox source = m._nonzero.intersect({srcRowOffs, srcRowOffs + nRows,
+                                              srcColOffs, srcColOffs + nCols});
+    NonzeroBox copied = NonzeroBox::empty();
+    if (!source.isEmpty()) {
+        copied = {source.rowBegin - srcRowOffs + rowOffs, source.rowEnd - srcRowOffs + rowOffs,
+                  source.colBegin - srcColOffs + colOffs, source.colEnd - srcColOffs + colOffs};
+        kernels::scale<T>(blockView(copied), m.blockView(source), 1);
     }
+    _nonzero = target.contains(_nonzero) ? copied : _nonzero.unite(copied);
 }
 
 //bool lab2::MatrixBuffer::resize(size_t nRows, size_t nCols) {
@@ -100,20 +262,85 @@ void lab2::MatrixBuffer::set(const lab2::MatrixBuffer &m,
 //    }
 //}
 
-void lab2::MatrixBuffer::swap(lab2::MatrixBuffer &m) {
+template <class T>
+void lab2::MatrixBuffer<T>::swap(lab2::MatrixBuffer<T> &m) {
     _data.swap(m._data);
+    std::swap(_elements, m._elements);
+    _owner.swap(m._owner);
     std::swap(_nRows, m._nRows);
     std::swap(_nCols, m._nCols);
+    std::swap(_nonzero, m._nonzero);
 }
 
-void lab2::MatrixBuffer::checkSize(const lab2::MatrixBuffer &m1, const lab2::MatrixBuffer &m2) {
+template <class T>
+void lab2::MatrixBuffer<T>::checkSize(const lab2::MatrixBuffer<T> &m1, const lab2::MatrixBuffer<T> &m2) {
     if (m1._nRows!=m2._nRows || m1._nCols!=m2._nCols) {
         throw std::runtime_error("Matrices have different size");
     }
 }
 
-void lab2::MatrixBuffer::checkAllocated(const lab2::MatrixBuffer &m) {
+template <class T>
+void lab2::MatrixBuffer<T>::checkAllocated(const lab2::MatrixBuffer<T> &m) {
     if (!m.isAllocated()) {
         throw std::runtime_error("Buffer is not allocated");
     }
 }
+
+template <class T>
+bool lab2::MatrixBuffer<T>::prepareProduct(const MatrixBuffer &m1, const MatrixBuffer &m2,
+                                           NonzeroBox &result, NonzeroBox &inner) {
+    if (m1._nCols != m2._nRows || m1._nRows != _nRows || m2._nCols != _nCols) {
+        throw std::runtime_error("Bad dimensions for matmul");
+    }
+    checkAllocated(m1);
+    checkAllocated(m2);
+    checkAllocated(*this);
+    fillZero(_nonzero);
+
+    // only rows of m1 and columns of m2 that have nonzeros contribute to the product,
+    // and only where nonzero columns of m1 meet nonzero rows of m2
+    const NonzeroBox &box1 = m1._nonzero, &box2 = m2._nonzero;
+    inner = NonzeroBox{0, 1, box1.colBegin, box1.colEnd}
+            .intersect({0, 1, box2.rowBegin, box2.rowEnd});
+    if (box1.isEmpty() || box2.isEmpty() || inner.isEmpty()) {
+        _nonzero = NonzeroBox::empty();
+        return false;
+    }
+    result = {box1.rowBegin, box1.rowEnd, box2.colBegin, box2.colEnd};
+    return true;
+}
+
+template <class T>
+lab2::MatrixView<T> lab2::MatrixBuffer<T>::blockView(const NonzeroBox &box) {
+    return MatrixView<T>(_elements, _nRows, _nCols)
+            .block(box.rowBegin, box.colBegin, box.getNRows(), box.getNCols());
+}
+
+template <class T>
+lab2::ConstMatrixView<T> lab2::MatrixBuffer<T>::blockView(const NonzeroBox &box) const {
+    return view().block(box.rowBegin, box.colBegin, box.getNRows(), box.getNCols());
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::fillZero(const NonzeroBox &box) {
+    if (!box.isEmpty()) kernels::fill<T>(blockView(box), 0);
+}
+
+template <class T>
+void lab2::MatrixBuffer<T>::fillZeroOutside(const NonzeroBox &box, const NonzeroBox &keep) {
+    NonzeroBox common = box.intersect(keep);
+    if (common.isEmpty()) {
+        fillZero(box);
+        return;
+    }
+    // bands above and below the common part, then the pieces left and right of it
+    fillZero({box.rowBegin, common.rowBegin, box.colBegin, box.colEnd});
+    fillZero({common.rowEnd, box.rowEnd, box.colBegin, box.colEnd});
+    fillZero({common.rowBegin, common.rowEnd, box.colBegin, common.colBegin});
+    fillZero({common.rowBegin, common.rowEnd, common.colEnd, box.colEnd});
+}
+
+
+#define INSTANTIATE_MATRIX_BUFFER(T) template class lab2::MatrixBuffer<T>;
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_MATRIX_BUFFER)
@@ -2,36 +2,121 @@
 #define MTP_LAB1_MATRIXBUFFER_H
 
 #include <vector>
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <algorithm>
+#include "MatrixView.h"
+#include "kernels.h"
 
 
 namespace lab2 {
 
+// Rectangle [rowBegin, rowEnd) x [colBegin, colEnd); all matrix elements outside of it are zero
+struct NonzeroBox {
+
+    size_t rowBegin, rowEnd, colBegin, colEnd;
+
+    static NonzeroBox empty() { return {0, 0, 0, 0}; }
+
+    bool isEmpty() const { return rowBegin >= rowEnd || colBegin >= colEnd; }
+    size_t getNRows() const { return isEmpty() ? 0 : rowEnd - rowBegin; }
+    size_t getNCols() const { return isEmpty() ? 0 : colEnd - colBegin; }
+
+    bool contains(const NonzeroBox &b) const {
+        return b.isEmpty() || (rowBegin <= b.rowBegin && b.rowEnd <= rowEnd
+                               && colBegin <= b.colBegin && b.colEnd <= colEnd);
+    }
+
+    NonzeroBox intersect(const NonzeroBox &b) const {
+        NonzeroBox result{std::max(rowBegin, b.rowBegin), std::min(rowEnd, b.rowEnd),
+                          std::max(colBegin, b.colBegin), std::min(colEnd, b.colEnd)};
+        return result.isEmpty() ? empty() : result;
+    }
+
+    NonzeroBox unite(const NonzeroBox &b) const {
+        if (isEmpty()) return b;
+        if (b.isEmpty()) return *this;
+        return {std::min(rowBegin, b.rowBegin), std::max(rowEnd, b.rowEnd),
+                std::min(colBegin, b.colBegin), std::max(colEnd, b.colEnd)};
+    }
+
+};
+
+
+template <class T, class E> class MatrixExpr;
+
+template <class T>
 class MatrixBuffer {
 
     size_t _nRows, _nCols;
-    std::vector<float> _data;
+    std::vector<T> _data;
+    // elements are either in _data or in external memory kept alive by _owner
+    T *_elements;
+    std::shared_ptr<void> _owner;
+    NonzeroBox _nonzero;
 
 public:
 
     MatrixBuffer(size_t nRows, size_t nCols)
             : _nRows(nRows)
             , _nCols(nCols)
-            , _data() {};
+            , _data()
+            , _elements(nullptr)
+            , _nonzero(NonzeroBox::empty()) {};
 
     size_t getNRows() const { return _nRows; }
     size_t getNCols() const { return _nCols; }
     size_t getTotalSize() const { return _nRows * _nCols; }
 
-    float& at(size_t row, size_t col);
-    const float& at(size_t row, size_t col) const;
+    // NOTE: writing through at() does not update the nonzero box,
+    // call shrinkNonzeroBox() or resetNonzeroBox() after such writes
+    T& at(size_t row, size_t col);
+    const T& at(size_t row, size_t col) const;
+
+    // writable view marks the whole buffer as possibly nonzero
+    MatrixView<T> view();
+    ConstMatrixView<T> view() const;
+
+    // Zero blocks of a matrix are tracked with a bounding box of its nonzero elements,
+    // so the arithmetic below touches only the part of data which may be nonzero
+    const NonzeroBox& getNonzeroBox() const { return _nonzero; }
+    bool isZero() const { return _nonzero.isEmpty(); }
+    void resetNonzeroBox() { _nonzero = {0, _nRows, 0, _nCols}; }
+    void shrinkNonzeroBox();
+    size_t countNonzeros() const;
 
     bool allocate();
     bool isAllocated() const;
     void free();
-
-    void add(const MatrixBuffer&, float coeff = 1);
-    void sum(const MatrixBuffer&, const MatrixBuffer&, float coeff = 1);
+    // Uses nRows*nCols elements at `data` instead of allocating them, e.g. a mapped file;
+    // `owner` is kept until the buffer is freed. The whole buffer is marked as nonzero.
+    void attach(T *data, const std::shared_ptr<void> &owner);
+    bool isExternal() const { return _owner != nullptr; }
+    // Moves elements held in memory to a new file at `path` and maps them back from there,
+    // so their pages are read again only when touched; false if that fails or if elements
+    // are already external. The file is removed at once, its space is kept by the mapping.
+    bool spill(const std::string &path);
+    // asks the kernel to read external elements into memory in advance
+    void prefetch() const;
+
+    // evaluates an expression of buffers in a single pass, see MatrixExpr.h
+    template <class E>
+    MatrixBuffer& operator=(const MatrixExpr<T, E> &expr);
+
+    void add(const MatrixBuffer&, T coeff = 1);
+    void sum(const MatrixBuffer&, const MatrixBuffer&, T coeff = 1);
+    // sum of coeffs[i]*terms[i], computed in a single pass
+    void combine(const std::vector<MatrixBuffer*> &terms, const std::vector<T> &coeffs);
     void mul(const MatrixBuffer&, const MatrixBuffer&);
+    // same as above, but the nonzero blocks of arguments are multiplied by `kernel`
+    void mul(const MatrixBuffer&, const MatrixBuffer&, const kernels::MulFunction<T> &kernel);
+
+    // Packed form of the nonzero box (see kernels::pack) for use as a right-hand operand;
+    // pack() returns false when memory cannot be allocated
+    bool pack(std::vector<T> &packed) const;
+    // same as mul(m1, m2), with m2 given also in the form packed by m2.pack()
+    void mulPacked(const MatrixBuffer&, const MatrixBuffer&, const std::vector<T> &packed2);
 
     void set(const MatrixBuffer&,
              size_t rowOffs = 0, size_t colOffs = 0,
@@ -49,6 +134,17 @@ private:
     static void checkSize(const MatrixBuffer& m1, const MatrixBuffer& m2);
     static void checkAllocated(const MatrixBuffer& m);
 
+    // clears this buffer for the product of m1 and m2 and finds its nonzero box and
+    // the range of inner dimension that contributes to it; false if the product is zero
+    bool prepareProduct(const MatrixBuffer &m1, const MatrixBuffer &m2,
+                        NonzeroBox &result, NonzeroBox &inner);
+
+    MatrixView<T> blockView(const NonzeroBox &box);
+    ConstMatrixView<T> blockView(const NonzeroBox &box) const;
+    void fillZero(const NonzeroBox &box);
+    // clears the part of `box` which is not in `keep`
+    void fillZeroOutside(const NonzeroBox &box, const NonzeroBox &keep);
+
 };
 
 }
@@ -0,0 +1,175 @@
+#ifndef MTP_LAB1_MATRIXEXPR_H
+#define MTP_LAB1_MATRIXEXPR_H
+
+#include <cstddef>
+#include <stdexcept>
+#include "MatrixBuffer.h"
+
+
+namespace lab2 {
+
+// Lazy elementwise expressions over MatrixBuffers, e.g. `c = a + 2*b - d`. Operators only
+// build a tree of small nodes; assigning it to a buffer evaluates all of it in a single
+// loop over rows, with no temporary matrices. Scalars go on the left of `*`.
+//
+// Each node E provides getNRows(), getNCols(), getNonzeroBox(), setRow(i) which moves it
+// to row i, and at(j) giving the element in column j of that row. Outside its nonzero box
+// an expression is zero.
+template <class T, class E>
+class MatrixExpr {
+
+public:
+
+    const E& self() const { return static_cast<const E&>(*this); }
+
+};
+
+
+// Elements of an allocated buffer
+template <class T>
+class BufferTerm : public MatrixExpr<T, BufferTerm<T>> {
+
+    ConstMatrixView<T> _view;
+    const MatrixBuffer<T> *_buffer;
+    const T *_row;
+
+public:
+
+    explicit BufferTerm(const MatrixBuffer<T> &m) : _view(m.view()), _buffer(&m), _row(nullptr) {}
+
+    size_t getNRows() const { return _view.nRows; }
+    size_t getNCols() const { return _view.nCols; }
+    NonzeroBox getNonzeroBox() const { return _buffer->getNonzeroBox(); }
+
+    void setRow(size_t i) { _row = _view.row(i); }
+    T at(size_t j) const { return _row[j]; }
+
+};
+
+
+template <class T, class E>
+class ScaledExpr : public MatrixExpr<T, ScaledExpr<T, E>> {
+
+    const T _coeff;
+    E _expr;
+
+public:
+
+    ScaledExpr(T coeff, const E &expr) : _coeff(coeff), _expr(expr) {}
+
+    size_t getNRows() const { return _expr.getNRows(); }
+    size_t getNCols() const { return _expr.getNCols(); }
+    NonzeroBox getNonzeroBox() const {
+        return _coeff == 0 ? NonzeroBox::empty() : _expr.getNonzeroBox();
+    }
+
+    void setRow(size_t i) { _expr.setRow(i); }
+    T at(size_t j) const { return _coeff * _expr.at(j); }
+
+};
+
+
+template <class T, class L, class R>
+class SumExpr : public MatrixExpr<T, SumExpr<T, L, R>> {
+
+    L _left;
+    R _right;
+
+public:
+
+    SumExpr(const L &left, const R &right) : _left(left), _right(right) {
+        if (left.getNRows() != right.getNRows() || left.getNCols() != right.getNCols()) {
+            throw std::runtime_error("Matrices have different size");
+        }
+    }
+
+    size_t getNRows() const { return _left.getNRows(); }
+    size_t getNCols() const { return _left.getNCols(); }
+    NonzeroBox getNonzeroBox() const { return _left.getNonzeroBox().unite(_right.getNonzeroBox()); }
+
+    void setRow(size_t i) {
+        _left.setRow(i);
+        _right.setRow(i);
+    }
+    T at(size_t j) const { return _left.at(j) + _right.at(j); }
+
+};
+
+
+// keeps T of a scalar operand from being deduced, so that `2*b` works for any T
+template <class T> struct ScalarOf { typedef T type; };
+
+template <class T, class L, class R>
+SumExpr<T, L, R> operator+(const MatrixExpr<T, L> &left, const MatrixExpr<T, R> &right) {
+    return {left.self(), right.self()};
+}
+template <class T, class R>
+SumExpr<T, BufferTerm<T>, R> operator+(const MatrixBuffer<T> &left, const MatrixExpr<T, R> &right) {
+    return {BufferTerm<T>(left), right.self()};
+}
+template <class T, class L>
+SumExpr<T, L, BufferTerm<T>> operator+(const MatrixExpr<T, L> &left, const MatrixBuffer<T> &right) {
+    return {left.self(), BufferTerm<T>(right)};
+}
+template <class T>
+SumExpr<T, BufferTerm<T>, BufferTerm<T>> operator+(const MatrixBuffer<T> &left, const MatrixBuffer<T> &right) {
+    return {BufferTerm<T>(left), BufferTerm<T>(right)};
+}
+
+template <class T, class E>
+ScaledExpr<T, E> operator*(typename ScalarOf<T>::type coeff, const MatrixExpr<T, E> &expr) {
+    return {coeff, expr.self()};
+}
+template <class T>
+ScaledExpr<T, BufferTerm<T>> operator*(typename ScalarOf<T>::type coeff, const MatrixBuffer<T> &m) {
+    return {coeff, BufferTerm<T>(m)};
+}
+
+template <class T, class E>
+ScaledExpr<T, E> operator-(const MatrixExpr<T, E> &expr) { return T(-1) * expr; }
+template <class T>
+ScaledExpr<T, BufferTerm<T>> operator-(const MatrixBuffer<T> &m) { return T(-1) * m; }
+
+template <class T, class L, class R>
+SumExpr<T, L, ScaledExpr<T, R>> operator-(const MatrixExpr<T, L> &left, const MatrixExpr<T, R> &right) {
+    return left + -right;
+}
+template <class T, class R>
+SumExpr<T, BufferTerm<T>, ScaledExpr<T, R>> operator-(const MatrixBuffer<T> &left, const MatrixExpr<T, R> &right) {
+    return left + -right;
+}
+template <class T, class L>
+SumExpr<T, L, ScaledExpr<T, BufferTerm<T>>> operator-(const MatrixExpr<T, L> &left, const MatrixBuffer<T> &right) {
+    return left + -right;
+}
+template <class T>
+SumExpr<T, BufferTerm<T>, ScaledExpr<T, BufferTerm<T>>> operator-(const MatrixBuffer<T> &left,
+                                                                   const MatrixBuffer<T> &right) {
+    return left + -right;
+}
+
+
+template <class T>
+template <class E>
+MatrixBuffer<T>& MatrixBuffer<T>::operator=(const MatrixExpr<T, E> &expr) {
+    if (expr.self().getNRows() != _nRows || expr.self().getNCols() != _nCols) {
+        throw std::runtime_error("Matrices have different size");
+    }
+    checkAllocated(*this);
+    // evaluated in place, row pointers of nodes change on the way
+    E e = expr.self();
+    NonzeroBox box = e.getNonzeroBox();
+    for (size_t i = box.rowBegin; i < box.rowEnd; i++) {
+        e.setRow(i);
+        T *dst = _elements + i*_nCols;
+        for (size_t j = box.colBegin; j < box.colEnd; j++) dst[j] = e.at(j);
+    }
+    // this buffer may be a term itself, so the rest is cleared only afterwards
+    fillZeroOutside(_nonzero, box);
+    _nonzero = box;
+    return *this;
+}
+
+}
+
+#endif //MTP_LAB1_MATRIXEXPR_H
@@ -0,0 +1,49 @@
+#ifndef MTP_LAB1_MATRIXVIEW_H
+#define MTP_LAB1_MATRIXVIEW_H
+
+#include <cstddef>
+
+
+namespace lab2 {
+
+// Non-owning window into row-major storage.
+// Rows of the window are `stride` elements apart, so a view can address
+// a block of a bigger matrix without copying it.
+template <class T>
+struct BasicMatrixView {
+
+    T *data;
+    size_t nRows, nCols, stride;
+
+    BasicMatrixView(T *data, size_t nRows, size_t nCols, size_t stride)
+            : data(data), nRows(nRows), nCols(nCols), stride(stride) {}
+
+    BasicMatrixView(T *data, size_t nRows, size_t nCols)
+            : BasicMatrixView(data, nRows, nCols, nCols) {}
+
+    // views over mutable data can be used where read-only view is expected
+    template <class U>
+    BasicMatrixView(const BasicMatrixView<U> &v)
+            : BasicMatrixView(v.data, v.nRows, v.nCols, v.stride) {}
+
+    T& at(size_t row, size_t col) const { return data[row*stride + col]; }
+    T* row(size_t row) const { return data + row*stride; }
+
+    BasicMatrixView block(size_t rowOffs, size_t colOffs, size_t nRows, size_t nCols) const {
+        return BasicMatrixView(data + rowOffs*stride + colOffs, nRows, nCols, stride);
+    }
+
+    // (i, j)-th block when splitting this view into 2x2 equal blocks
+    BasicMatrixView quadrant(int i, int j) const {
+        size_t subRows = nRows / 2, subCols = nCols / 2;
+        return block(i*subRows, j*subCols, subRows, subCols);
+    }
+
+};
+
+template <class T> using MatrixView = BasicMatrixView<T>;
+template <class T> using ConstMatrixView = BasicMatrixView<const T>;
+
+}
+
+#endif //MTP_LAB1_MATRIXVIEW_H
@@ -0,0 +1,179 @@
+#include "SparseMatrix.h"
+#include "dtypes.h"
+#include <algorithm>
+#include <stdexcept>
+
+template <class T>
+double lab2::SparseMatrix<T>::getDensity() const {
+    size_t total = _nRows * _nCols;
+    return total == 0 ? 0 : (double)getNNonzeros() / total;
+}
+
+template <class T>
+bool lab2::SparseMatrix<T>::assign(const MatrixBuffer<T> &m, size_t rowBegin) {
+    if (m.getNCols() != _nCols || rowBegin + _nRows > m.getNRows()) {
+        throw std::runtime_error("Matrices have different size");
+    }
+    ConstMatrixView<T> src = m.view();
+    const NonzeroBox &box = m.getNonzeroBox();
+    _cols.clear();
+    _values.clear();
+    try {
+        for (size_t r = 0; r < _nRows; r++) {
+            _rowStarts[r] = _values.size();
+            size_t row = rowBegin + r;
+            if (row < box.rowBegin || row >= box.rowEnd) continue;
+            const T *data = src.row(row);
+            for (size_t c = box.colBegin; c < box.colEnd; c++) {
+                if (data[c] == 0) continue;
+                _cols.push_back(c);
+                _values.push_back(data[c]);
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    _rowStarts[_nRows] = _values.size();
+    return true;
+}
+
+template <class T>
+void lab2::SparseMatrix<T>::copyTo(MatrixBuffer<T> &dst, size_t rowOffs) const {
+    if (dst.getNCols() != _nCols || rowOffs + _nRows > dst.getNRows()) {
+        throw std::runtime_error("Matrices have different size");
+    }
+    MatrixView<T> view = dst.view();
+    for (size_t r = 0; r < _nRows; r++) {
+        T *row = view.row(rowOffs + r);
+        for (size_t i = _rowStarts[r]; i < _rowStarts[r + 1]; i++) {
+            row[_cols[i]] = _values[i];
+        }
+    }
+}
+
+template <class T>
+bool lab2::SparseMatrix<T>::concat(const std::vector<const SparseMatrix*> &parts) {
+    size_t nRows = 0, nNonzeros = 0;
+    for (auto part : parts) {
+        if (part->_nCols != _nCols) throw std::runtime_error("Matrices have different size");
+        nRows += part->_nRows;
+        nNonzeros += part->getNNonzeros();
+    }
+    if (nRows != _nRows) throw std::runtime_error("Matrices have different size");
+    try {
+        _cols.resize(nNonzeros);
+        _values.resize(nNonzeros);
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    size_t row = 0, offs = 0;
+    for (auto part : parts) {
+        for (size_t r = 0; r < part->_nRows; r++) {
+            _rowStarts[row++] = offs + part->_rowStarts[r];
+        }
+        std::copy(part->_cols.begin(), part->_cols.end(), _cols.begin() + offs);
+        std::copy(part->_values.begin(), part->_values.end(), _values.begin() + offs);
+        offs += part->getNNonzeros();
+    }
+    _rowStarts[_nRows] = offs;
+    return true;
+}
+
+template <class T>
+bool lab2::SparseMatrix<T>::mul(const SparseMatrix &m1, const SparseMatrix &m2, size_t rowBegin) {
+    checkProduct(_nRows, _nCols, m1, m2._nRows, m2._nCols, rowBegin);
+    _cols.clear();
+    _values.clear();
+    try {
+        std::vector<T> acc(_nCols, 0);
+        // columns touched in the current row, and which of them are there already
+        std::vector<size_t> touched;
+        std::vector<bool> isTouched(_nCols, false);
+        for (size_t r = 0; r < _nRows; r++) {
+            _rowStarts[r] = _values.size();
+            size_t row = rowBegin + r;
+            for (size_t i = m1._rowStarts[row]; i < m1._rowStarts[row + 1]; i++) {
+                size_t k = m1._cols[i];
+                T a = m1._values[i];
+                for (size_t j = m2._rowStarts[k]; j < m2._rowStarts[k + 1]; j++) {
+                    size_t c = m2._cols[j];
+                    if (!isTouched[c]) {
+                        isTouched[c] = true;
+                        touched.push_back(c);
+                    }
+                    acc[c] += a * m2._values[j];
+                }
+            }
+            std::sort(touched.begin(), touched.end());
+            for (size_t c : touched) {
+                // terms may cancel out
+                if (acc[c] != 0) {
+                    _cols.push_back(c);
+                    _values.push_back(acc[c]);
+                }
+                acc[c] = 0;
+                isTouched[c] = false;
+            }
+            touched.clear();
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    _rowStarts[_nRows] = _values.size();
+    return true;
+}
+
+template <class T>
+void lab2::SparseMatrix<T>::mul(MatrixBuffer<T> &dst, const SparseMatrix &m1, const SparseMatrix &m2,
+                                size_t rowBegin) {
+    checkProduct(dst.getNRows(), dst.getNCols(), m1, m2._nRows, m2._nCols, rowBegin);
+    MatrixView<T> view = dst.view();
+    for (size_t r = 0; r < view.nRows; r++) {
+        T *out = view.row(r);
+        size_t row = rowBegin + r;
+        for (size_t i = m1._rowStarts[row]; i < m1._rowStarts[row + 1]; i++) {
+            size_t k = m1._cols[i];
+            T a = m1._values[i];
+            for (size_t j = m2._rowStarts[k]; j < m2._rowStarts[k + 1]; j++) {
+                out[m2._cols[j]] += a * m2._values[j];
+            }
+        }
+    }
+    dst.shrinkNonzeroBox();
+}
+
+template <class T>
+void lab2::SparseMatrix<T>::mul(MatrixBuffer<T> &dst, const SparseMatrix &m1, const MatrixBuffer<T> &m2,
+                                size_t rowBegin) {
+    checkProduct(dst.getNRows(), dst.getNCols(), m1, m2.getNRows(), m2.getNCols(), rowBegin);
+    const NonzeroBox &box = m2.getNonzeroBox();
+    ConstMatrixView<T> src = m2.view();
+    MatrixView<T> view = dst.view();
+    for (size_t r = 0; r < view.nRows; r++) {
+        T *out = view.row(r);
+        size_t row = rowBegin + r;
+        for (size_t i = m1._rowStarts[row]; i < m1._rowStarts[row + 1]; i++) {
+            size_t k = m1._cols[i];
+            if (k < box.rowBegin || k >= box.rowEnd) continue;
+            T a = m1._values[i];
+            const T *in = src.row(k);
+            for (size_t c = box.colBegin; c < box.colEnd; c++) {
+                out[c] += a * in[c];
+            }
+        }
+    }
+    dst.shrinkNonzeroBox();
+}
+
+template <class T>
+void lab2::SparseMatrix<T>::checkProduct(size_t nRows, size_t nCols, const SparseMatrix &m1,
+                                         size_t nInner2, size_t nCols2, size_t rowBegin) {
+    if (rowBegin + nRows > m1._nRows || m1._nCols != nInner2 || nCols != nCols2) {
+        throw std::runtime_error("Matrices have different size");
+    }
+}
+
+
+#define INSTANTIATE_SPARSE_MATRIX(T) template class lab2::SparseMatrix<T>;
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_SPARSE_MATRIX)
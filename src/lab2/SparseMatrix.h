@@ -0,0 +1,56 @@
+#ifndef MTP_LAB1_SPARSEMATRIX_H
+#define MTP_LAB1_SPARSEMATRIX_H
+
+#include <vector>
+#include <cstddef>
+#include "MatrixBuffer.h"
+
+
+namespace lab2 {
+
+// Matrix in compressed sparse row (CSR) form: nonzero elements of row r are
+// _values[_rowStarts[r] .. _rowStarts[r+1]), in increasing order of their _cols.
+// Functions returning bool return false when memory cannot be allocated.
+template <class T>
+class SparseMatrix {
+
+    size_t _nRows, _nCols;
+    std::vector<size_t> _rowStarts;
+    std::vector<size_t> _cols;
+    std::vector<T> _values;
+
+public:
+
+    SparseMatrix(size_t nRows, size_t nCols)
+            : _nRows(nRows), _nCols(nCols), _rowStarts(nRows + 1, 0) {}
+
+    size_t getNRows() const { return _nRows; }
+    size_t getNCols() const { return _nCols; }
+    size_t getNNonzeros() const { return _values.size(); }
+    double getDensity() const;
+
+    // rows [rowBegin, rowBegin + getNRows()) of a dense matrix
+    bool assign(const MatrixBuffer<T> &m, size_t rowBegin = 0);
+    // writes into rows [rowOffs, rowOffs + getNRows()) of allocated dst, which must be zero
+    // there; the whole dst is marked as nonzero, see MatrixBuffer::shrinkNonzeroBox()
+    void copyTo(MatrixBuffer<T> &dst, size_t rowOffs = 0) const;
+    // rows of given matrices one after another
+    bool concat(const std::vector<const SparseMatrix*> &parts);
+
+    // Rows [rowBegin, rowBegin + getNRows()) of m1 * m2, row by row with a dense
+    // accumulator (Gustavson's algorithm)
+    bool mul(const SparseMatrix &m1, const SparseMatrix &m2, size_t rowBegin = 0);
+    // same into allocated dst, which must be zero
+    static void mul(MatrixBuffer<T> &dst, const SparseMatrix &m1, const SparseMatrix &m2, size_t rowBegin = 0);
+    // same for dense m2: rows of m2 scaled by nonzeros of m1 are added to dst
+    static void mul(MatrixBuffer<T> &dst, const SparseMatrix &m1, const MatrixBuffer<T> &m2, size_t rowBegin = 0);
+
+private:
+    static void checkProduct(size_t nRows, size_t nCols, const SparseMatrix &m1, size_t nInner2, size_t nCols2,
+                             size_t rowBegin);
+
+};
+
+}
+
+#endif //MTP_LAB1_SPARSEMATRIX_H
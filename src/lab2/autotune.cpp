@@ -0,0 +1,124 @@
+#include "autotune.h"
+#include "schemes.h"
+#include "kernels.h"
+#include "dtypes.h"
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+
+
+namespace {
+
+// Wall time of running `work` on each of nThreads threads simultaneously
+double measure(unsigned nThreads, const std::function<void()> &work) {
+    using namespace std::chrono;
+    double best = -1;
+    double total = 0;
+    // repeat short runs to get rid of noise, but don't spend too long on big ones
+    for (int run = 0; run < 5 && (run < 2 || total < 0.2); run++) {
+        auto start = steady_clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < nThreads; i++) threads.push_back(std::thread{work});
+        work();
+        for (auto &t : threads) t.join();
+        double time = duration<double>(steady_clock::now() - start).count();
+        total += time;
+        if (best < 0 || time < best) best = time;
+    }
+    return best;
+}
+
+}
+
+
+template <class T>
+size_t lab2::autotuneStrassenLimit(unsigned nThreads, std::ostream &log) {
+    const size_t sizes[] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+    const SchemeList strassen = parseSchemeList("strassen");
+
+    size_t limit = 0;
+    int nWins = 0;
+    for (size_t n : sizes) {
+        std::vector<T> m1(n*n), m2(n*n);
+        for (size_t i = 0; i < n*n; i++) {
+            m1[i] = (T)(i % 19) - 9;
+            m2[i] = (T)(i % 23) - 11;
+        }
+        ConstMatrixView<T> a{m1.data(), n, n}, b{m2.data(), n, n};
+
+        double leafTime = measure(nThreads, [&] () {
+            std::vector<T> dst(n*n);
+            kernels::mul<T>(MatrixView<T>{dst.data(), n, n}, a, b);
+        });
+        double levelTime = measure(nThreads, [&] () {
+            std::vector<T> dst(n*n);
+            std::vector<T> workspace(schemeWorkspaceSize(strassen, 0, n, n, n, n/2));
+            schemeMul<T>(MatrixView<T>{dst.data(), n, n}, a, b, strassen, 0, workspace.data(), n/2);
+        });
+        log << "n-threads " << nThreads << ", size " << n
+            << ": leaf " << leafTime << "s, strassen level " << levelTime << "s" << std::endl;
+
+        // stop as soon as recursion wins twice in a row, so that a single noisy
+        // measurement does not decide the crossover
+        if (levelTime < leafTime) {
+            if (++nWins == 2) break;
+        } else {
+            nWins = 0;
+            limit = n;
+        }
+    }
+    return limit > 0 ? limit : sizes[0];
+}
+
+#define INSTANTIATE_AUTOTUNE(T) \
+    template size_t lab2::autotuneStrassenLimit<T>(unsigned, std::ostream&);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_AUTOTUNE)
+
+
+lab2::TuningFile::TuningFile(const std::string &path) : _path(path) {
+    std::ifstream file{_path};
+    std::string key;
+    unsigned nThreads;
+    size_t value;
+    while (file >> key >> nThreads >> value) {
+        _values[key][nThreads] = value;
+    }
+}
+
+std::string lab2::TuningFile::defaultPath() {
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const char *home = std::getenv("HOME");
+    std::string dir = home != nullptr ? std::string(home) + "/" : "";
+    return dir + ".mtp-lab2-" + host + ".tune";
+}
+
+bool lab2::TuningFile::get(const std::string &key, unsigned nThreads, size_t &value) const {
+    auto it = _values.find(key);
+    if (it == _values.end() || it->second.empty()) return false;
+    const auto &byThreads = it->second;
+    auto best = byThreads.upper_bound(nThreads);
+    if (best != byThreads.begin()) best--;
+    value = best->second;
+    return true;
+}
+
+void lab2::TuningFile::set(const std::string &key, unsigned nThreads, size_t value) {
+    _values[key][nThreads] = value;
+}
+
+bool lab2::TuningFile::save() const {
+    std::ofstream file{_path};
+    for (const auto &entry : _values) {
+        for (const auto &byThreads : entry.second) {
+            file << entry.first << ' ' << byThreads.first << ' ' << byThreads.second << '\n';
+        }
+    }
+    file.close();
+    return !file.fail();
+}
@@ -0,0 +1,45 @@
+#ifndef MTP_LAB1_AUTOTUNE_H
+#define MTP_LAB1_AUTOTUNE_H
+
+#include <map>
+#include <string>
+#include <ostream>
+
+
+namespace lab2 {
+
+// Finds the size at which one level of Strassen's recursion becomes faster than
+// the leaf kernel when `nThreads` threads multiply independent matrices of T at once.
+// Returns the biggest tested size at which the leaf kernel still wins.
+template <class T>
+size_t autotuneStrassenLimit(unsigned nThreads, std::ostream &log);
+
+// key of the tuned strassen-limit for elements of given dtype, e.g. "strassen-limit.double"
+inline std::string strassenLimitKey(const std::string &dtype) { return "strassen-limit." + dtype; }
+
+// Tuned parameters of one host, stored as "<key> <n-threads> <value>" lines
+class TuningFile {
+
+public:
+
+    explicit TuningFile(const std::string &path);
+
+    // file in user's home directory named after the host
+    static std::string defaultPath();
+
+    // value tuned for the closest thread count not exceeding nThreads
+    // (or for the smallest one, if all are bigger), false if nothing is known
+    bool get(const std::string &key, unsigned nThreads, size_t &value) const;
+    void set(const std::string &key, unsigned nThreads, size_t value);
+
+    bool save() const;
+
+private:
+    const std::string _path;
+    std::map<std::string, std::map<unsigned, size_t>> _values;
+
+};
+
+}
+
+#endif //MTP_LAB1_AUTOTUNE_H
@@ -0,0 +1,60 @@
+#include "batch.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace {
+
+// "d0,d1,...,dn", or a single size when all nMatrices matrices are square
+std::vector<size_t> parseDims(const std::string &text, size_t nMatrices) {
+    std::vector<size_t> dims;
+    std::stringstream ss{text};
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t pos = 0;
+        long dim = -1;
+        try {
+            dim = std::stol(item, &pos);
+        } catch (const std::logic_error&) {}
+        if (dim <= 0 || pos != item.size()) throw std::runtime_error("dimensions must be positive integers");
+        dims.push_back((size_t)dim);
+    }
+    if (dims.size() == 1) dims.resize(nMatrices + 1, dims[0]);
+    if (dims.size() != nMatrices + 1) {
+        throw std::runtime_error("one dimension more than the number of input files is required");
+    }
+    return dims;
+}
+
+}
+
+
+std::vector<lab2::ChainJob> lab2::readBatchFile(const std::string &path) {
+    std::ifstream in{path};
+    if (!in) throw std::runtime_error("Cannot open " + path);
+    return readBatch(in, path);
+}
+
+std::vector<lab2::ChainJob> lab2::readBatch(std::istream &in, const std::string &name) {
+    std::vector<ChainJob> jobs;
+    std::string line;
+    for (size_t lineNo = 1; std::getline(in, line); lineNo++) {
+        std::stringstream ss{line};
+        std::string dims;
+        if (!(ss >> dims) || dims[0] == '#') continue;
+        ChainJob job;
+        std::string inName;
+        ss >> job.outName;
+        while (ss >> inName) job.inNames.push_back(inName);
+        try {
+            if (job.inNames.empty()) throw std::runtime_error("output and input file names are required");
+            job.dims = parseDims(dims, job.inNames.size());
+        } catch (const std::runtime_error &err) {
+            throw std::runtime_error(name + ":" + std::to_string(lineNo) + ": " + err.what());
+        }
+        jobs.push_back(job);
+    }
+    if (in.bad()) throw std::runtime_error("Cannot read " + name);
+    return jobs;
+}
@@ -0,0 +1,35 @@
+#ifndef MTP_LAB1_BATCH_H
+#define MTP_LAB1_BATCH_H
+
+#include <string>
+#include <vector>
+#include <istream>
+
+
+namespace lab2 {
+
+// Product of a chain of matrices from inNames with dimensions dims (as for ChainPlan), written to outName
+struct ChainJob {
+    std::vector<std::string> inNames;
+    std::string outName;
+    std::vector<size_t> dims;
+};
+
+// What happened to a job: error message, empty if it is done, and seconds
+// since it was handed over for running until its output was written
+struct JobResult {
+    std::string error;
+    double seconds;
+};
+
+// Reads a batch file with one job per line:
+//     <d0,d1,...,dn or size of square matrices> <out-name> <in-name>...
+// Empty lines and lines starting with '#' are skipped. Throws std::runtime_error
+// telling the line when the file cannot be read or a job is malformed.
+std::vector<ChainJob> readBatchFile(const std::string &path);
+// same from a stream, `name` is used in error messages
+std::vector<ChainJob> readBatch(std::istream &in, const std::string &name);
+
+}
+
+#endif //MTP_LAB1_BATCH_H
@@ -0,0 +1,70 @@
+#include "chain.h"
+#include <algorithm>
+#include <stdexcept>
+
+
+lab2::ProductCost
+lab2::estimateSchemeCost(const SchemeList &schemes, size_t limit, unsigned graphLevels,
+                         size_t nRows, size_t nInner, size_t nCols, size_t level) {
+    const auto &scheme = schemeAt(schemes, level);
+    if (isSchemeLeaf(scheme, nRows, nInner, nCols, limit)) {
+        double flops = 2.0 * nRows * nInner * nCols;
+        return {flops, flops};
+    }
+    size_t m = nRows / scheme.m, k = nInner / scheme.k, n = nCols / scheme.n;
+    ProductCost product = estimateSchemeCost(schemes, limit, graphLevels > 0 ? graphLevels - 1 : 0,
+                                             m, k, n, level + 1);
+
+    double sumsA = 0, sumsB = 0, sumsC = 0;
+    for (size_t r = 0; r < scheme.rank; r++) {
+        sumsA += std::count_if(scheme.U[r].begin(), scheme.U[r].end(), [] (float x) { return x != 0; }) - 1;
+        sumsB += std::count_if(scheme.V[r].begin(), scheme.V[r].end(), [] (float x) { return x != 0; }) - 1;
+    }
+    for (const auto &row : scheme.W) {
+        sumsC += std::count_if(row.begin(), row.end(), [] (float x) { return x != 0; }) - 1;
+    }
+    double sizeA = (double)m * k, sizeB = (double)k * n, sizeC = (double)m * n;
+    double additions = sumsA * sizeA + sumsB * sizeB + sumsC * sizeC;
+
+    // peeled rows and columns, if any, are multiplied directly
+    size_t coreRows = m * scheme.m, coreInner = k * scheme.k, coreCols = n * scheme.n;
+    double peeled = 2.0 * ((double)nRows * nInner * nCols - (double)coreRows * coreInner * coreCols);
+
+    ProductCost cost;
+    cost.work = scheme.rank * product.work + additions + peeled;
+    if (graphLevels > 0) {
+        // products run in parallel, but each waits for its operand sums
+        // and the result blocks wait for the products
+        cost.span = product.span + sizeA + sizeB + 2 * sizeC + peeled;
+    } else {
+        cost.span = cost.work;
+    }
+    return cost;
+}
+
+
+lab2::ChainPlan::ChainPlan(const std::vector<size_t> &dims, unsigned nThreads, const CostModel &model) {
+    if (dims.size() < 2) throw std::runtime_error("Empty chain of matrices");
+    size_t n = dims.size() - 1;
+    _split.assign(n, std::vector<size_t>(n, 0));
+    std::vector<std::vector<ProductCost>> best(n, std::vector<ProductCost>(n, ProductCost{0, 0}));
+
+    for (size_t length = 2; length <= n; length++) {
+        for (size_t first = 0; first + length <= n; first++) {
+            size_t last = first + length - 1;
+            bool found = false;
+            for (size_t k = first; k < last; k++) {
+                const ProductCost &left = best[first][k], &right = best[k+1][last];
+                ProductCost product = model(dims[first], dims[k+1], dims[last+1]);
+                ProductCost total{left.work + right.work + product.work,
+                                  std::max(left.span, right.span) + product.span};
+                if (!found || total.time(nThreads) < best[first][last].time(nThreads)) {
+                    best[first][last] = total;
+                    _split[first][last] = k;
+                    found = true;
+                }
+            }
+        }
+    }
+    _cost = best[0][n-1];
+}
@@ -0,0 +1,51 @@
+#ifndef MTP_LAB1_CHAIN_H
+#define MTP_LAB1_CHAIN_H
+
+#include <vector>
+#include <functional>
+#include "schemes.h"
+
+
+namespace lab2 {
+
+// Estimated amount of floating point operations needed for a computation
+struct ProductCost {
+    double work;    // total, performed by all threads
+    double span;    // along the critical path, which cannot be parallelized
+
+    // expected running time on given number of threads (Brent's bound)
+    double time(unsigned nThreads) const { return work / nThreads + span; }
+};
+
+typedef std::function<ProductCost(size_t nRows, size_t nInner, size_t nCols)> CostModel;
+
+// Cost of the scheme engines: top `graphLevels` of recursion run their
+// products in parallel, the rest is sequential. Additions are weighted
+// by the number of nonzero coefficients in scheme tables.
+ProductCost estimateSchemeCost(const SchemeList &schemes, size_t limit, unsigned graphLevels,
+                               size_t nRows, size_t nInner, size_t nCols, size_t level = 0);
+
+// Order of multiplications in a chain of matrices with dimensions
+// dims[0] x dims[1], dims[1] x dims[2], ..., dims[n-1] x dims[n]
+class ChainPlan {
+
+public:
+
+    // Classic matrix-chain dynamic programming, where each product is weighted by
+    // the cost model and independent subchains are assumed to run in parallel
+    ChainPlan(const std::vector<size_t> &dims, unsigned nThreads, const CostModel &model);
+
+    // product of matrices first..last is split into (first..k) * (k+1..last)
+    size_t getSplit(size_t first, size_t last) const { return _split[first][last]; }
+
+    const ProductCost& getCost() const { return _cost; }
+
+private:
+    std::vector<std::vector<size_t>> _split;
+    ProductCost _cost;
+
+};
+
+}
+
+#endif //MTP_LAB1_CHAIN_H
@@ -0,0 +1,17 @@
+#ifndef MTP_LAB1_DTYPES_H
+#define MTP_LAB1_DTYPES_H
+
+#include <cstdint>
+
+
+// Element types of matrices supported by lab2 (see --dtype).
+// Templates implemented in .cpp files are explicitly instantiated for each of them with
+//     LAB2_FOR_EACH_DTYPE(INSTANTIATE_SOMETHING)
+#define LAB2_FOR_EACH_DTYPE(MACRO) \
+    MACRO(float) \
+    MACRO(double) \
+    MACRO(int32_t) \
+    MACRO(int64_t)
+
+
+#endif //MTP_LAB1_DTYPES_H
@@ -0,0 +1,276 @@
+#include "kernels.h"
+#include "dtypes.h"
+#include <stdexcept>
+#include <algorithm>
+
+
+namespace {
+
+using lab2::MatrixView;
+using lab2::ConstMatrixView;
+
+// Kernels for N x N leaves. All trip counts and the blocking of the inner dimension
+// are compile-time constants, so the compiler unrolls and vectorizes the loops
+// without remainder handling.
+template <class T, size_t N>
+struct FixedKernels {
+
+    // rows of m2 used by one pass over dst, kept small enough to stay in L1
+    static constexpr size_t innerBlock = N < 64 ? N : 64;
+
+    static void mulAdd(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+        for (size_t blockBegin = 0; blockBegin < N; blockBegin += innerBlock) {
+            for (size_t r = 0; r < N; r++) {
+                T *d = dst.row(r);
+                const T *a = m1.row(r) + blockBegin;
+                for (size_t i = 0; i < innerBlock; i++) {
+                    const T ai = a[i];
+                    const T *b = m2.row(blockBegin + i);
+                    for (size_t c = 0; c < N; c++) {
+                        d[c] += ai * b[c];
+                    }
+                }
+            }
+        }
+    }
+
+    static void sum(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2, T coeff) {
+        for (size_t r = 0; r < N; r++) {
+            T *d = dst.row(r);
+            const T *a = m1.row(r), *b = m2.row(r);
+            if (coeff == 1) {
+                for (size_t c = 0; c < N; c++) d[c] = a[c] + b[c];
+            } else if (coeff == -1) {
+                for (size_t c = 0; c < N; c++) d[c] = a[c] - b[c];
+            } else {
+                for (size_t c = 0; c < N; c++) d[c] = a[c] + coeff * b[c];
+            }
+        }
+    }
+
+};
+
+bool isSquare(size_t n, size_t nRows, size_t nCols) {
+    return nRows == n && nCols == n;
+}
+
+// Runtime dispatch to FixedKernels by the leaf size, returns false for other sizes
+template <class T>
+bool mulAddFixed(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+    size_t n = dst.nRows;
+    if (!isSquare(n, dst.nRows, dst.nCols) || !isSquare(n, m1.nRows, m1.nCols)
+            || !isSquare(n, m2.nRows, m2.nCols)) {
+        return false;
+    }
+    switch (n) {
+        case 32:  FixedKernels<T, 32>::mulAdd(dst, m1, m2);  return true;
+        case 64:  FixedKernels<T, 64>::mulAdd(dst, m1, m2);  return true;
+        case 128: FixedKernels<T, 128>::mulAdd(dst, m1, m2); return true;
+        case 256: FixedKernels<T, 256>::mulAdd(dst, m1, m2); return true;
+        default:  return false;
+    }
+}
+
+template <class T>
+bool sumFixed(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2, T coeff) {
+    size_t n = dst.nRows;
+    if (!isSquare(n, dst.nRows, dst.nCols)) return false;
+    switch (n) {
+        case 32:  FixedKernels<T, 32>::sum(dst, m1, m2, coeff);  return true;
+        case 64:  FixedKernels<T, 64>::sum(dst, m1, m2, coeff);  return true;
+        case 128: FixedKernels<T, 128>::sum(dst, m1, m2, coeff); return true;
+        case 256: FixedKernels<T, 256>::sum(dst, m1, m2, coeff); return true;
+        default:  return false;
+    }
+}
+
+}
+
+
+template <class T>
+void lab2::kernels::sum(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2, T coeff) {
+    if (dst.nRows != m1.nRows || dst.nRows != m2.nRows
+            || dst.nCols != m1.nCols || dst.nCols != m2.nCols) {
+        throw std::runtime_error("Matrices have different size");
+    }
+    if (sumFixed<T>(dst, m1, m2, coeff)) return;
+    for (size_t r = 0; r < dst.nRows; r++) {
+        T *d = dst.row(r);
+        const T *a = m1.row(r), *b = m2.row(r);
+        // schemes use unit coefficients almost everywhere, so spare the multiplication
+        if (coeff == 1) {
+            for (size_t c = 0; c < dst.nCols; c++) d[c] = a[c] + b[c];
+        } else if (coeff == -1) {
+            for (size_t c = 0; c < dst.nCols; c++) d[c] = a[c] - b[c];
+        } else {
+            for (size_t c = 0; c < dst.nCols; c++) d[c] = a[c] + coeff * b[c];
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::combine(MatrixView<T> dst, const std::vector<ConstMatrixView<T>> &terms,
+                            const std::vector<T> &coeffs) {
+    if (terms.empty() || terms.size() != coeffs.size()) {
+        throw std::runtime_error("Bad number of coefficients for linear combination");
+    }
+    for (const auto &term : terms) {
+        if (dst.nRows != term.nRows || dst.nCols != term.nCols) {
+            throw std::runtime_error("Matrices have different size");
+        }
+    }
+    // a row of dst stays in cache while all the terms are accumulated into it
+    for (size_t r = 0; r < dst.nRows; r++) {
+        T *d = dst.row(r);
+        const T *a = terms[0].row(r);
+        const T first = coeffs[0];
+        for (size_t c = 0; c < dst.nCols; c++) d[c] = first * a[c];
+        for (size_t i = 1; i < terms.size(); i++) {
+            const T *b = terms[i].row(r);
+            const T coeff = coeffs[i];
+            if (coeff == 1) {
+                for (size_t c = 0; c < dst.nCols; c++) d[c] += b[c];
+            } else if (coeff == -1) {
+                for (size_t c = 0; c < dst.nCols; c++) d[c] -= b[c];
+            } else {
+                for (size_t c = 0; c < dst.nCols; c++) d[c] += coeff * b[c];
+            }
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::scale(MatrixView<T> dst, ConstMatrixView<T> m, T coeff) {
+    if (dst.nRows != m.nRows || dst.nCols != m.nCols) {
+        throw std::runtime_error("Matrices have different size");
+    }
+    for (size_t r = 0; r < dst.nRows; r++) {
+        T *d = dst.row(r);
+        const T *a = m.row(r);
+        for (size_t c = 0; c < dst.nCols; c++) {
+            d[c] = coeff * a[c];
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::fill(MatrixView<T> dst, T value) {
+    for (size_t r = 0; r < dst.nRows; r++) {
+        T *d = dst.row(r);
+        for (size_t c = 0; c < dst.nCols; c++) {
+            d[c] = value;
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::mul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+    fill<T>(dst, 0);
+    mulAdd<T>(dst, m1, m2);
+}
+
+template <class T>
+void lab2::kernels::mulAdd(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+    if (m1.nCols != m2.nRows || dst.nRows != m1.nRows || dst.nCols != m2.nCols) {
+        throw std::runtime_error("Bad dimensions for matmul");
+    }
+    if (mulAddFixed<T>(dst, m1, m2)) return;
+    // i-k-j order: innermost loop runs along rows of both m2 and dst
+    for (size_t r = 0; r < dst.nRows; r++) {
+        T *d = dst.row(r);
+        for (size_t i = 0; i < m1.nCols; i++) {
+            const T a = m1.at(r, i);
+            const T *b = m2.row(i);
+            for (size_t c = 0; c < dst.nCols; c++) {
+                d[c] += a * b[c];
+            }
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::pack(T *packed, ConstMatrixView<T> m) {
+    for (size_t panel = 0; panel < m.nCols; panel += packedPanelWidth) {
+        size_t width = std::min(packedPanelWidth, m.nCols - panel);
+        for (size_t r = 0; r < m.nRows; r++) {
+            const T *src = m.row(r) + panel;
+            std::copy(src, src + width, packed);
+            packed += width;
+        }
+    }
+}
+
+template <class T>
+void lab2::kernels::mulAddPacked(MatrixView<T> dst, ConstMatrixView<T> m1,
+                                 const T *packed, size_t packedRows, size_t rowOffs) {
+    if (dst.nRows != m1.nRows || rowOffs + m1.nCols > packedRows) {
+        throw std::runtime_error("Bad dimensions for matmul");
+    }
+    for (size_t panel = 0; panel < dst.nCols; panel += packedPanelWidth) {
+        size_t width = std::min(packedPanelWidth, dst.nCols - panel);
+        const T *panelData = packed + panel*packedRows + rowOffs*width;
+        for (size_t r = 0; r < dst.nRows; r++) {
+            T *d = dst.row(r) + panel;
+            const T *a = m1.row(r);
+            for (size_t i = 0; i < m1.nCols; i++) {
+                const T ai = a[i];
+                const T *b = panelData + i*width;
+                for (size_t c = 0; c < width; c++) {
+                    d[c] += ai * b[c];
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+bool lab2::kernels::peel(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+                         size_t rowsDivisor, size_t innerDivisor, size_t colsDivisor,
+                         const MulFunction<T> &core) {
+    size_t nRows = m1.nRows, nInner = m1.nCols, nCols = m2.nCols;
+    size_t coreRows = nRows - nRows % rowsDivisor;
+    size_t coreInner = nInner - nInner % innerDivisor;
+    size_t coreCols = nCols - nCols % colsDivisor;
+    if (coreRows == nRows && coreInner == nInner && coreCols == nCols) return false;
+
+    MatrixView<T> dstCore = dst.block(0, 0, coreRows, coreCols);
+    core(dstCore, m1.block(0, 0, coreRows, coreInner), m2.block(0, 0, coreInner, coreCols));
+    if (coreInner < nInner) {
+        mulAdd<T>(dstCore,
+                  m1.block(0, coreInner, coreRows, nInner - coreInner),
+                  m2.block(coreInner, 0, nInner - coreInner, coreCols));
+    }
+    if (coreCols < nCols) {
+        mul<T>(dst.block(0, coreCols, coreRows, nCols - coreCols),
+               m1.block(0, 0, coreRows, nInner),
+               m2.block(0, coreCols, nInner, nCols - coreCols));
+    }
+    if (coreRows < nRows) {
+        mul<T>(dst.block(coreRows, 0, nRows - coreRows, nCols),
+               m1.block(coreRows, 0, nRows - coreRows, nInner),
+               m2);
+    }
+    return true;
+}
+
+
+#define INSTANTIATE_KERNELS(T) \
+    template void lab2::kernels::sum<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                        lab2::ConstMatrixView<T>, T); \
+    template void lab2::kernels::combine<T>(lab2::MatrixView<T>, \
+                                            const std::vector<lab2::ConstMatrixView<T>>&, \
+                                            const std::vector<T>&); \
+    template void lab2::kernels::scale<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, T); \
+    template void lab2::kernels::fill<T>(lab2::MatrixView<T>, T); \
+    template void lab2::kernels::mul<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                        lab2::ConstMatrixView<T>); \
+    template void lab2::kernels::mulAdd<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                           lab2::ConstMatrixView<T>); \
+    template void lab2::kernels::pack<T>(T*, lab2::ConstMatrixView<T>); \
+    template void lab2::kernels::mulAddPacked<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                                 const T*, size_t, size_t); \
+    template bool lab2::kernels::peel<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                         lab2::ConstMatrixView<T>, size_t, size_t, size_t, \
+                                         const lab2::kernels::MulFunction<T>&);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_KERNELS)
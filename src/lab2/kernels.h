@@ -0,0 +1,68 @@
+#ifndef MTP_LAB1_KERNELS_H
+#define MTP_LAB1_KERNELS_H
+
+#include <functional>
+#include <vector>
+#include "MatrixView.h"
+
+
+// All kernels are templates over element type instantiated for lab2 dtypes.
+// Their inner loops run over contiguous rows, so that the compiler can vectorize them
+// for each element type; callers specify the type explicitly, e.g. kernels::sum<T>(...)
+namespace lab2 {
+namespace kernels {
+
+// dst = m1 + coeff*m2, dst may be the same view as m1 or m2
+template <class T>
+void sum(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2, T coeff = 1);
+
+// dst = sum of coeffs[i]*terms[i] in a single pass over the rows,
+// dst may be the same view as the first term only
+template <class T>
+void combine(MatrixView<T> dst, const std::vector<ConstMatrixView<T>> &terms, const std::vector<T> &coeffs);
+
+// dst = coeff*m, dst may be the same view as m
+template <class T>
+void scale(MatrixView<T> dst, ConstMatrixView<T> m, T coeff);
+
+template <class T>
+void fill(MatrixView<T> dst, T value);
+
+// dst = m1 * m2, dst must not overlap with arguments
+template <class T>
+void mul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2);
+
+// dst += m1 * m2, dst must not overlap with arguments
+template <class T>
+void mulAdd(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2);
+
+// Right-hand operands can be packed into column panels of this width: panel p holds
+// columns [p*width, (p+1)*width) of all rows, row after row, so that a multiplication
+// streams through it contiguously whatever the stride of the original matrix was
+const size_t packedPanelWidth = 64;
+
+// packed must hold m.nRows*m.nCols elements
+template <class T>
+void pack(T *packed, ConstMatrixView<T> m);
+
+// dst += m1 * rows [rowOffs, rowOffs + m1.nCols) of the packed matrix,
+// which has packedRows rows and dst.nCols columns
+template <class T>
+void mulAddPacked(MatrixView<T> dst, ConstMatrixView<T> m1,
+                  const T *packed, size_t packedRows, size_t rowOffs);
+
+template <class T>
+using MulFunction = std::function<void(MatrixView<T>, ConstMatrixView<T>, ConstMatrixView<T>)>;
+
+// Dynamic peeling: if some dimension is not divisible by its divisor, multiplies
+// the divisible leading blocks with `core`, computes the remaining thin rows and
+// columns directly and returns true. Returns false if nothing had to be peeled.
+template <class T>
+bool peel(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+          size_t rowsDivisor, size_t innerDivisor, size_t colsDivisor,
+          const MulFunction<T> &core);
+
+}
+}
+
+#endif //MTP_LAB1_KERNELS_H
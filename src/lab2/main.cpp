@@ -2,10 +2,25 @@
 #include <vector>
 #include <chrono>
 #include <iostream>
+#include <sstream>
+#include <limits>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <map>
+#include <malloc.h>
+#include <memory>
 #include "../cli-args/Parser.h"
 #include "../mt/TaskGraph.h"
 #include "tasks.h"
 #include "strassen.h"
+#include "chain.h"
+#include "autotune.h"
+#include "outofcore.h"
+#include "sparse.h"
+#include "batch.h"
+#include "server.h"
+#include "../matfile/ResultCache.h"
 
 
 unsigned getPositive(const cli::Arguments& args,
@@ -23,60 +38,545 @@ unsigned getPositive(const cli::Arguments& args,
     return (unsigned)result;
 }
 
-size_t getPaddedSize(size_t origSize) {
-    size_t result = 1;
-    while (result < origSize) result <<= 1;
-    return result;
+unsigned getNonNegative(const cli::Arguments& args,
+                        const cli::Parser &parser,
+                        const std::string &key,
+                        unsigned defaultValue) {
+    if (!args.hasParam(key)) return defaultValue;
+    int result = 0;
+    try {
+        result = std::stoi(args.param(key));
+    } catch (const std::invalid_argument&) {
+        parser.fail(key, "Required integer", true);
+    }
+    if (result < 0) {
+        parser.fail(key, "Required non-negative integer", true);
+    }
+    return (unsigned)result;
 }
 
 using namespace lab2;
 
 
-int main(int argc, char **argv) {
-    cli::Parser parser{"lab2", "Multiplies matrices from given files"};
-    parser  .param("n-threads", "-n", "", "Number of threads")
-            .param("size", "-N", "", "Matrix dimensions")
-            .param("strassen-limit", "-L", "", "Size limit for stopping Strassen's algorithm")
-            .param("out-name", "-o", "", "Output file name")
-            .positional("in-names", "+");
-    auto args = parser.parse(argc, argv);
-    unsigned nWorkers = getPositive(args, parser, "n-threads");
-    size_t limit = getPositive(args, parser, "strassen-limit");
-    size_t matSize = getPositive(args, parser, "size");
-    size_t paddedSize = getPaddedSize(matSize);
+template <class T>
+using MatmulFunction = std::function<Lab2BaseTask<T>*(Lab2BaseTask<T>*, Lab2BaseTask<T>*)>;
+
+template <class T>
+using ChainPartFunction = std::function<Lab2BaseTask<T>*(size_t first, size_t last)>;
+
+// Product of matrices first..last in the order of the plan. `known` gives the input matrices,
+// and the products which need not be computed, e.g. cached ones; nullptr for the rest.
+template <class T>
+Lab2BaseTask<T>* defineChainProduct(const ChainPlan &plan, size_t first, size_t last,
+                                    const ChainPartFunction<T> &known, const MatmulFunction<T> &matmul) {
+    Lab2BaseTask<T>* product = known(first, last);
+    if (product != nullptr) return product;
+    size_t split = plan.getSplit(first, last);
+    return matmul(defineChainProduct(plan, first, split, known, matmul),
+                  defineChainProduct(plan, split + 1, last, known, matmul));
+}
+
+// dimensions of the chain of matrices, either "d0,d1,...,dn" from --dims or all equal to --size
+std::vector<size_t> getChainDims(const cli::Arguments& args, const cli::Parser &parser, size_t nMatrices) {
+    if (args.hasParam("dims") == args.hasParam("size")) {
+        parser.fail("Exactly one of --size and --dims is required", true);
+    }
+    if (args.hasParam("size")) {
+        return std::vector<size_t>(nMatrices + 1, getPositive(args, parser, "size"));
+    }
+    std::vector<size_t> dims;
+    std::stringstream ss{args.param("dims")};
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t pos = 0;
+        long dim = -1;
+        try {
+            dim = std::stol(item, &pos);
+        } catch (const std::logic_error&) {}
+        if (dim <= 0 || pos != item.size()) parser.fail("dims", "Required positive integers", true);
+        dims.push_back((size_t)dim);
+    }
+    if (dims.size() != nMatrices + 1) {
+        parser.fail("dims", "Required one dimension more than the number of input files", true);
+    }
+    return dims;
+}
+
+// Input files must be readable, and binary ones must match the dimensions given for them;
+// returns what is wrong, empty if nothing
+std::string checkInputs(const ChainJob &job) {
+    for (size_t i = 0; i < job.inNames.size(); i++) {
+        try {
+            if (!matfile::isMatrixFile(job.inNames[i])) {
+                matfile::MappedFile file{job.inNames[i]};
+                continue;
+            }
+            matfile::MappedMatrix matrix{job.inNames[i]};
+            if (matrix.getNRows() != job.dims[i] || matrix.getNCols() != job.dims[i + 1]) {
+                return job.inNames[i] + " has other dimensions";
+            }
+        } catch (const std::runtime_error &err) {
+            return err.what();
+        }
+    }
+    return "";
+}
+
 
+// Builds a single task graph multiplying the chains of matrices with elements of type T
+// for all jobs with valid inputs and runs it on the pool, so that independent jobs share the threads.
+// With a cache, products found there are read instead of computed, and the rest are stored.
+template <class T>
+std::vector<JobResult> runChainProducts(const std::vector<ChainJob> &jobs, mt::WorkerPool &pool, size_t limit,
+                                        const std::string &engine, unsigned graphLevels, const SchemeList &schemes,
+                                        bool morton, size_t memoryBudget, matfile::Format outFormat,
+                                        double sparseDensity, matfile::ResultCache *cache) {
+    auto handedOver = std::chrono::steady_clock::now();
+    unsigned nWorkers = pool.getNThreads();
     mt::TaskGraph graph;
+    graph.setMemoryBudget(memoryBudget);
 
-    std::vector<Lab2BaseTask*> matricesWave{};
-    for(const auto& name : args.paramlist("in-names")) {
-        Lab2BaseTask* loader = new MatrixReader(
-                name,
-                matSize, matSize,
-                paddedSize, paddedSize
-        );
-        matricesWave.push_back(loader);
-        graph.addTask(loader, {});
+    MatmulFunction<T> matmul;
+    SchemeList costSchemes;
+    unsigned costGraphLevels = graphLevels;
+    if (engine == "winograd") {
+        matmul = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+            return matmulWinograd<T>(graph, m1, m2, limit, graphLevels, morton);
+        };
+        costSchemes = parseSchemeList("winograd");
+    } else if (engine == "scheme") {
+        matmul = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+            return matmulScheme<T>(graph, m1, m2, schemes, limit, graphLevels);
+        };
+        costSchemes = schemes;
+    } else {
+        matmul = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+            return matmulStrassen<T>(graph, m1, m2, limit);
+        };
+        costSchemes = parseSchemeList("strassen");
+        costGraphLevels = std::numeric_limits<unsigned>::max();
     }
 
-    while(matricesWave.size() > 1) {
-        std::vector<Lab2BaseTask*> matricesNextWave{};
-        for (size_t i = 1; i < matricesWave.size(); i+=2) {
-            Lab2BaseTask* result = matmulStrassen(
-                    graph, matricesWave[i-1], matricesWave[i], limit);
-            matricesNextWave.push_back(result);
+    // measured for inputs, estimated for products
+    std::map<Lab2BaseTask<T>*, double> densities;
+    // products with a sparse operand go to sparse kernels, the rest to the engine
+    MatmulFunction<T> chooseMatmul = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+        double density1 = densities[m1], density2 = densities[m2];
+        double density = estimateProductDensity(density1, density2, m1->getNCols());
+        bool sparse1 = density1 <= sparseDensity, sparse2 = density2 <= sparseDensity;
+        Lab2BaseTask<T> *product = sparse1 || sparse2
+                ? matmulSparse<T>(graph, m1, m2, nWorkers, sparse1 && sparse2 && density <= sparseDensity)
+                : matmul(m1, m2);
+        densities[product] = density;
+        return product;
+    };
+
+    // A file given several times is read once. Density is measured for binary files only,
+    // where it is a cheap scan of mapped data; text ones are taken as dense, so that they
+    // are not scanned once more before the parallel parse.
+    auto addReader = [&] (const std::string &name, size_t nRows, size_t nCols) {
+        bool binary = matfile::isMatrixFile(name);
+        auto reader = graph.addShared(new MatrixReader<T>(name, nRows, nCols, nWorkers,
+                                                          binary ? sparseDensity : 0), {});
+        if (densities.count(reader) > 0) return reader;
+        densities[reader] = 1;
+        if (binary && sparseDensity > 0) {
+            try {
+                densities[reader] = measureDensity(name);
+            } catch (const std::runtime_error&) {}
         }
-        if (matricesWave.size() % 2 == 1)
-            matricesNextWave.push_back(matricesWave[matricesWave.size()-1]);
-        matricesWave.swap(matricesNextWave);
+        return reader;
+    };
+
+    // Integer products are exact, so they are cached under the keys of their input matrices
+    // and found whatever the order of multiplications was. Rounding of floating-point ones
+    // depends on that order and on the algorithm, so they are keyed on the keys of their two
+    // operands and on the settings of the engine.
+    const bool exact = std::is_integral<T>::value;
+    std::string productOf = std::string(matfile::dtypeName(matfile::DTypeOf<T>::value)) + " product of";
+    if (!exact) {
+        std::stringstream ss;
+        ss << ' ' << engine << " limit " << limit << " sparse " << sparseDensity;
+        if (engine == "winograd" && morton) ss << " morton";
+        if (engine == "scheme") for (auto scheme : schemes) ss << ' ' << scheme->name;
+        productOf += ss.str();
+    }
+    // Chains identify matrices: " key..." of the inputs of exact products, or " key" of
+    // the matrix itself
+    std::map<Lab2BaseTask<T>*, std::string> chains;
+    auto chainOfProduct = [&] (const std::string &chain1, const std::string &chain2) -> std::string {
+        return exact ? chain1 + chain2 : ' ' + matfile::ResultCache::keyOf(productOf + chain1 + chain2);
+    };
+    auto keyOfChain = [&] (const std::string &chain) {
+        return exact ? matfile::ResultCache::keyOf(productOf + chain) : chain.substr(1);
+    };
+    size_t nHits = 0, nMisses = 0;
+    MatmulFunction<T> cachingMatmul = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+        Lab2BaseTask<T> *product = chooseMatmul(m1, m2);
+        // products of the same operands are shared, see mt::TaskGraph::addShared()
+        if (cache != nullptr && chains.count(product) == 0) {
+            chains[product] = chainOfProduct(chains[m1], chains[m2]);
+            auto store = new CacheWriter<T>(cache, keyOfChain(chains[product]),
+                                            product->getNRows(), product->getNCols());
+            graph.addTask(store, {product});
+        }
+        return product;
+    };
+
+    std::vector<JobResult> results(jobs.size(), JobResult{"", 0});
+    std::vector<MatrixWriter<T>*> savers(jobs.size(), nullptr);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const ChainJob &job = jobs[i];
+        results[i].error = checkInputs(job);
+        if (!results[i].error.empty()) continue;
+        // of input files with their dimensions
+        std::vector<std::string> keys(job.inNames.size());
+        if (cache != nullptr) {
+            try {
+                for (size_t k = 0; k < keys.size(); k++) {
+                    std::stringstream ss;
+                    ss << job.dims[k] << 'x' << job.dims[k + 1] << ' '
+                       << matfile::ResultCache::keyOfFile(job.inNames[k]);
+                    keys[k] = matfile::ResultCache::keyOf(ss.str());
+                }
+            } catch (const std::runtime_error &err) {
+                results[i].error = err.what();
+                continue;
+            }
+        }
+        ChainPlan plan{job.dims, nWorkers, [&] (size_t nRows, size_t nInner, size_t nCols) {
+            return estimateSchemeCost(costSchemes, limit, costGraphLevels, nRows, nInner, nCols);
+        }};
+        // of the product of matrices first..last computed in the order of the plan
+        std::function<std::string(size_t, size_t)> chainOf = [&] (size_t first, size_t last) -> std::string {
+            if (first == last) return ' ' + keys[first];
+            size_t split = plan.getSplit(first, last);
+            return chainOfProduct(chainOf(first, split), chainOf(split + 1, last));
+        };
+        ChainPartFunction<T> known = [&] (size_t first, size_t last) -> Lab2BaseTask<T>* {
+            if (first == last) {
+                auto reader = addReader(job.inNames[first], job.dims[first], job.dims[first + 1]);
+                chains[reader] = ' ' + keys[first];
+                return reader;
+            }
+            if (cache == nullptr) return nullptr;
+            std::string chain = chainOf(first, last);
+            std::string path = cache->lookup(keyOfChain(chain));
+            if (path.empty()) {
+                nMisses++;
+                return nullptr;
+            }
+            nHits++;
+            auto reader = addReader(path, job.dims[first], job.dims[last + 1]);
+            chains[reader] = chain;
+            return reader;
+        };
+
+        Lab2BaseTask<T>* product = defineChainProduct<T>(plan, 0, job.inNames.size() - 1, known, cachingMatmul);
+
+        savers[i] = new MatrixWriter<T>(job.outName, job.dims.front(), job.dims.back(), outFormat, nWorkers);
+        graph.addTask(savers[i], {product});
     }
-    auto saver = new MatrixWriter(args.param("out-name"), matSize, matSize);
-    graph.addTask(saver, {matricesWave[0]});
 
     using namespace std::chrono;
     milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
-    graph.runAll(nWorkers);
+    graph.runAll(pool);
     milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
     auto dur = end-start;
     std::cout << "time: " << dur.count()/1000.0 << "s" << std::endl;
+    SpillManager *spillManager = SpillManager::getCurrent();
+    if (spillManager != nullptr && spillManager->getSpilledMemory() > 0) {
+        std::cout << "spilled: " << (spillManager->getSpilledMemory() >> 20) << " MiB" << std::endl;
+    }
+    if (cache != nullptr) {
+        std::cout << "cache: " << nHits << " hits, " << nMisses << " misses" << std::endl;
+    }
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (savers[i] == nullptr) continue;
+        results[i].error = savers[i]->getError();
+        results[i].seconds = duration_cast<duration<double>>(savers[i]->getDoneTime() - handedOver).count();
+    }
+    graph.deleteTasks();
+    return results;
+}
+
+// Same for matrices which do not fit in memory, false on errors
+template <class T>
+bool runOutOfCore(const std::vector<std::string> &inNames, const std::string &outName,
+                  matfile::Format outFormat, const std::vector<size_t> &dims,
+                  const std::string &scratchDir, size_t tileSize, unsigned nWorkers, size_t cacheBudget) {
+    using namespace std::chrono;
+    milliseconds start = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+    try {
+        multiplyChainOutOfCore<T>(inNames, outName, outFormat, dims, scratchDir, tileSize, nWorkers, cacheBudget);
+    } catch (const std::runtime_error &err) {
+        std::cout << err.what() << std::endl;
+        return false;
+    }
+    milliseconds end = duration_cast<milliseconds>(system_clock::now().time_since_epoch());
+    auto dur = end-start;
+    std::cout << "time: " << dur.count()/1000.0 << "s" << std::endl;
+    return true;
+}
+
 
+int main(int argc, char **argv) {
+    cli::Parser parser{"lab2", "Multiplies matrices from given files"};
+    parser  .param("n-threads", "-n", "", "Number of threads")
+            .param("size", "-N", "?", "Matrix dimensions, when all matrices are square")
+            .param("dims", "-D", "?", "Comma-separated dimensions of the chain of matrices: d0,d1,...,dn")
+            .param("strassen-limit", "-L", "?", "Size limit for stopping Strassen's algorithm (default is tuned)")
+            .param("out-name", "-o", "?", "Output file name")
+            .param("engine", "-e", "?", "Multiplication engine: strassen (default), winograd or scheme")
+            .param("graph-levels", "-G", "?", "Recursion levels run in parallel by winograd and scheme engines (default 2)")
+            .param("scheme", "-S", "?", "Comma-separated schemes for recursion levels of scheme engine (default strassen)")
+            .param("layout", "-l", "?", "Data layout for winograd engine: row-major (default) or morton")
+            .param("dtype", "-t", "?", "Element type: float (default), double, int32 or int64")
+            .param("memory-budget", "-M", "?", "Memory in MiB for matrices of tasks running in parallel (default unlimited), "
+                                              "or for the tile cache in out-of-core mode (default 1024)")
+            .param("out-of-core", "-O", "?", "Multiply out of core, keeping matrices as tiles in given scratch directory")
+            .param("tile-size", "-Z", "?", "Tile size for out-of-core mode (default 1024)")
+            .param("sparse-density", "-s", "?", "Max fraction of nonzeros for binary input matrices kept and "
+                                               "multiplied in sparse form (default 0.05, 0 disables)")
+            .param("spill-dir", "-P", "?", "Spill idle intermediate matrices to given scratch directory "
+                                          "when memory-budget is exceeded")
+            .param("cache-dir", "-K", "?", "Reuse products of the same input files, keeping them in given directory")
+            .param("cache-size", "-k", "?", "Size limit of the cache in MiB, over which least recently used "
+                                           "products are evicted (default 1024)")
+            .param("batch", "-b", "?", "Run all jobs from given file in one graph, one job per line: "
+                                      "<d0,d1,...,dn or size> <out-name> <in-name>...")
+            .param("serve", "-U", "?", "Stay resident and run jobs sent to Unix domain socket at given path")
+            .param("connect", "-C", "?", "Send jobs to the server at given socket path and print its reply")
+            .flag("shutdown", "-Q", "With --connect, stop the server")
+            .param("tuning-file", "-F", "?", "Per-host tuning file (default ~/.mtp-lab2-<host>.tune)")
+            .flag("binary-output", "-B", "Write output in binary format")
+            .flag("autotune", "-T", "Find strassen-limit for 1..n-threads threads and given dtype (default all) "
+                                    "and store it in tuning file; untuned dtypes use the float one")
+            .positional("in-names", "*");
+    auto args = parser.parse(argc, argv);
+    unsigned nWorkers = getPositive(args, parser, "n-threads");
+    std::string dtype = args.hasParam("dtype") ? args.param("dtype") : "float";
+    if (dtype != "float" && dtype != "double" && dtype != "int32" && dtype != "int64") {
+        parser.fail("dtype", "Unknown element type", true);
+    }
+    TuningFile tuning{args.hasParam("tuning-file") ? args.param("tuning-file") : TuningFile::defaultPath()};
+
+    if (args.flag("autotune")) {
+        // element sizes and vector widths differ, so each dtype is tuned on its own
+        std::vector<std::string> dtypes{dtype};
+        if (!args.hasParam("dtype")) dtypes = {"float", "double", "int32", "int64"};
+        for (const auto &tunedType : dtypes) {
+            for (unsigned nThreads = 1; ; nThreads = std::min(2*nThreads, nWorkers)) {
+                size_t tuned;
+                if (tunedType == "float") {
+                    tuned = autotuneStrassenLimit<float>(nThreads, std::cout);
+                } else if (tunedType == "double") {
+                    tuned = autotuneStrassenLimit<double>(nThreads, std::cout);
+                } else if (tunedType == "int32") {
+                    tuned = autotuneStrassenLimit<int32_t>(nThreads, std::cout);
+                } else {
+                    tuned = autotuneStrassenLimit<int64_t>(nThreads, std::cout);
+                }
+                std::cout << "strassen-limit for " << tunedType << ", " << nThreads << " threads: "
+                          << tuned << std::endl;
+                tuning.set(strassenLimitKey(tunedType), nThreads, tuned);
+                if (nThreads == nWorkers) break;
+            }
+        }
+        if (!tuning.save()) {
+            std::cout << "Cannot save tuning file" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    bool serving = args.hasParam("serve");
+    if (serving && args.hasParam("connect")) parser.fail("serve", "Cannot both serve and connect", true);
+    if (args.hasParam("connect") && args.flag("shutdown")) {
+        return shutdownServer(args.param("connect")) ? 0 : 1;
+    }
+    std::vector<ChainJob> jobs;
+    if (serving) {
+        if (!args.paramlist("in-names").empty() || args.hasParam("out-name") || args.hasParam("batch")
+            || args.hasParam("size") || args.hasParam("dims")) {
+            parser.fail("serve", "Jobs come from clients", true);
+        }
+    } else if (args.hasParam("batch")) {
+        if (!args.paramlist("in-names").empty() || args.hasParam("out-name")
+            || args.hasParam("size") || args.hasParam("dims")) {
+            parser.fail("batch", "Jobs are given in batch file only", true);
+        }
+        try {
+            jobs = readBatchFile(args.param("batch"));
+        } catch (const std::runtime_error &err) {
+            parser.fail("batch", err.what(), true);
+        }
+    } else {
+        if (args.paramlist("in-names").empty()) parser.fail("in-names", "required", true);
+        if (!args.hasParam("out-name")) parser.fail("out-name", "required", true);
+        jobs.push_back({args.paramlist("in-names"), args.param("out-name"),
+                        getChainDims(args, parser, args.paramlist("in-names").size())});
+    }
+    if (args.hasParam("connect")) {
+        try {
+            return submit(args.param("connect"), jobs, std::cout) ? 0 : 1;
+        } catch (const std::runtime_error &err) {
+            parser.fail("connect", err.what(), true);
+        }
+    }
+    // jobs of a batch fail one by one, the same as submitted ones
+    if (!args.hasParam("batch")) {
+        for (const auto &job : jobs) {
+            std::string error = checkInputs(job);
+            if (!error.empty()) parser.fail("in-names", error, true);
+        }
+    }
+
+    bool outOfCore = args.hasParam("out-of-core");
+    size_t limit = 0;
+    if (args.hasParam("strassen-limit")) {
+        limit = getPositive(args, parser, "strassen-limit");
+    } else if (!outOfCore && !tuning.get(strassenLimitKey(dtype), nWorkers, limit)
+               && !tuning.get(strassenLimitKey("float"), nWorkers, limit)
+               // written before dtypes were tuned separately
+               && !tuning.get("strassen-limit", nWorkers, limit)) {
+        parser.fail("strassen-limit", "required, unless tuned for this host with --autotune", true);
+    }
+    std::string engine = args.hasParam("engine") ? args.param("engine") : "strassen";
+    if (engine != "strassen" && engine != "winograd" && engine != "scheme") {
+        parser.fail("engine", "Unknown engine", true);
+    }
+    unsigned graphLevels = getNonNegative(args, parser, "graph-levels", 2);
+    SchemeList schemes;
+    if (engine == "scheme") {
+        try {
+            schemes = parseSchemeList(args.hasParam("scheme") ? args.param("scheme") : "strassen");
+        } catch (const std::runtime_error &err) {
+            parser.fail("scheme", err.what(), true);
+        }
+    }
+    std::string layout = args.hasParam("layout") ? args.param("layout") : "row-major";
+    if (layout != "row-major" && layout != "morton") {
+        parser.fail("layout", "Unknown layout", true);
+    }
+    if (layout == "morton" && engine != "winograd") {
+        parser.fail("layout", "Morton layout is supported by winograd engine only", true);
+    }
+    bool morton = layout == "morton";
+    size_t memoryBudget = std::numeric_limits<size_t>::max();
+    if (args.hasParam("memory-budget")) {
+        memoryBudget = (size_t)getPositive(args, parser, "memory-budget") << 20;
+    }
+    matfile::Format outFormat = args.flag("binary-output") ? matfile::BINARY : matfile::TEXT;
+    double sparseDensity = 0.05;
+    if (args.hasParam("sparse-density")) {
+        try {
+            sparseDensity = std::stod(args.param("sparse-density"));
+        } catch (const std::logic_error&) {
+            sparseDensity = -1;
+        }
+        if (sparseDensity < 0 || sparseDensity > 1) {
+            parser.fail("sparse-density", "Required number between 0 and 1", true);
+        }
+    }
+    if (dtype == "int32" || dtype == "int64") {
+        for (auto scheme : schemes) {
+            if (!scheme->isIntegral()) {
+                parser.fail("scheme", "Scheme " + scheme->name + " has fractional coefficients", true);
+            }
+        }
+    }
+
+    std::unique_ptr<SpillManager> spillManager;
+    if (args.hasParam("spill-dir")) {
+        if (outOfCore) parser.fail("spill-dir", "Out-of-core mode keeps everything on disk anyway", true);
+        if (!args.hasParam("memory-budget")) parser.fail("spill-dir", "requires memory-budget", true);
+        spillManager.reset(new SpillManager(args.param("spill-dir"), memoryBudget));
+        SpillManager::setCurrent(spillManager.get());
+    }
+
+    std::unique_ptr<matfile::ResultCache> cache;
+    if (args.hasParam("cache-size") && !args.hasParam("cache-dir")) {
+        parser.fail("cache-size", "requires cache-dir", true);
+    }
+    if (args.hasParam("cache-dir")) {
+        if (outOfCore) parser.fail("cache-dir", "Out-of-core mode does not use the cache", true);
+        size_t cacheSize = args.hasParam("cache-size") ? getPositive(args, parser, "cache-size") : 1024;
+        try {
+            cache.reset(new matfile::ResultCache(args.param("cache-dir"), cacheSize << 20));
+        } catch (const std::runtime_error &err) {
+            parser.fail("cache-dir", err.what(), true);
+        }
+    }
+
+    if (outOfCore) {
+        if (args.hasParam("engine") || args.hasParam("layout")) {
+            parser.fail("out-of-core", "Tiles are multiplied directly, engines are not used", true);
+        }
+        if (args.hasParam("batch") || serving) {
+            parser.fail("out-of-core", "Batches are run in memory only", true);
+        }
+        const ChainJob &job = jobs.front();
+        size_t tileSize = args.hasParam("tile-size") ? getPositive(args, parser, "tile-size") : 1024;
+        size_t cacheBudget = args.hasParam("memory-budget") ? memoryBudget : size_t(1024) << 20;
+        const std::string &scratchDir = args.param("out-of-core");
+        bool ok;
+        if (dtype == "float") {
+            ok = runOutOfCore<float>(job.inNames, job.outName, outFormat, job.dims, scratchDir, tileSize, nWorkers, cacheBudget);
+        } else if (dtype == "double") {
+            ok = runOutOfCore<double>(job.inNames, job.outName, outFormat,
+                                      job.dims, scratchDir, tileSize, nWorkers, cacheBudget);
+        } else if (dtype == "int32") {
+            ok = runOutOfCore<int32_t>(job.inNames, job.outName, outFormat,
+                                       job.dims, scratchDir, tileSize, nWorkers, cacheBudget);
+        } else {
+            ok = runOutOfCore<int64_t>(job.inNames, job.outName, outFormat,
+                                       job.dims, scratchDir, tileSize, nWorkers, cacheBudget);
+        }
+        return ok ? 0 : 1;
+    }
+
+    mt::WorkerPool pool{nWorkers};
+    JobRunner runner;
+    if (dtype == "float") {
+        runner = [&] (const std::vector<ChainJob> &jobs) {
+            return runChainProducts<float>(jobs, pool, limit, engine, graphLevels, schemes,
+                                           morton, memoryBudget, outFormat, sparseDensity, cache.get());
+        };
+    } else if (dtype == "double") {
+        runner = [&] (const std::vector<ChainJob> &jobs) {
+            return runChainProducts<double>(jobs, pool, limit, engine, graphLevels, schemes,
+                                            morton, memoryBudget, outFormat, sparseDensity, cache.get());
+        };
+    } else if (dtype == "int32") {
+        runner = [&] (const std::vector<ChainJob> &jobs) {
+            return runChainProducts<int32_t>(jobs, pool, limit, engine, graphLevels, schemes,
+                                             morton, memoryBudget, outFormat, sparseDensity, cache.get());
+        };
+    } else {
+        runner = [&] (const std::vector<ChainJob> &jobs) {
+            return runChainProducts<int64_t>(jobs, pool, limit, engine, graphLevels, schemes,
+                                             morton, memoryBudget, outFormat, sparseDensity, cache.get());
+        };
+    }
+
+    if (serving) {
+        // freed matrices stay in the heap for the next jobs, instead of going back
+        // to the kernel and being faulted in again
+        mallopt(M_MMAP_THRESHOLD, 32 << 20);
+        mallopt(M_TRIM_THRESHOLD, std::numeric_limits<int>::max());
+        try {
+            serve(args.param("serve"), runner);
+        } catch (const std::runtime_error &err) {
+            parser.fail("serve", err.what(), true);
+        }
+        return 0;
+    }
+    bool ok = true;
+    for (const auto &result : runner(jobs)) {
+        if (result.error.empty()) continue;
+        std::cout << result.error << std::endl;
+        ok = false;
+    }
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,155 @@
+#include "morton.h"
+#include "kernels.h"
+#include "dtypes.h"
+#include <algorithm>
+
+
+namespace {
+
+// part of `v` starting at (rowOffs, colOffs) of at most nRows x nCols elements
+template <class T>
+lab2::BasicMatrixView<T> clip(lab2::BasicMatrixView<T> v, size_t rowOffs, size_t colOffs,
+                              size_t nRows, size_t nCols) {
+    if (rowOffs >= v.nRows || colOffs >= v.nCols) return lab2::BasicMatrixView<T>(v.data, 0, 0, v.stride);
+    return v.block(rowOffs, colOffs,
+                   std::min(nRows, v.nRows - rowOffs), std::min(nCols, v.nCols - colOffs));
+}
+
+template <class T>
+void sum(lab2::MortonView<T> dst, lab2::ConstMortonView<T> m1, lab2::ConstMortonView<T> m2, T coeff = 1) {
+    lab2::kernels::sum<T>(dst.flat(), m1.flat(), m2.flat(), coeff);
+}
+
+}
+
+
+unsigned lab2::mortonLevels(size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    unsigned levels = 0;
+    while (std::min(mortonTileSize(nRows, levels),
+                    std::min(mortonTileSize(nInner, levels), mortonTileSize(nCols, levels))) > limit) {
+        levels++;
+    }
+    return levels;
+}
+
+size_t lab2::mortonWorkspaceSize(size_t tileRows, size_t tileInner, size_t tileCols, unsigned levels) {
+    if (levels == 0) return 0;
+    size_t quadrantTiles = size_t(1) << 2*(levels - 1);
+    return (std::max(tileRows*tileInner, tileRows*tileCols) + tileInner*tileCols) * quadrantTiles
+           + mortonWorkspaceSize(tileRows, tileInner, tileCols, levels - 1);
+}
+
+template <class T>
+void lab2::toMorton(MortonView<T> dst, ConstMatrixView<T> src) {
+    if (dst.levels == 0) {
+        for (size_t r = 0; r < dst.tileRows; r++) {
+            T *row = dst.data + r*dst.tileCols;
+            size_t nCopied = r < src.nRows ? src.nCols : 0;
+            std::copy(src.row(r), src.row(r) + nCopied, row);
+            std::fill(row + nCopied, row + dst.tileCols, T(0));
+        }
+        return;
+    }
+    size_t halfRows = dst.getNRows() / 2, halfCols = dst.getNCols() / 2;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            toMorton<T>(dst.quadrant(i, j), clip(src, i*halfRows, j*halfCols, halfRows, halfCols));
+        }
+    }
+}
+
+template <class T>
+void lab2::fromMorton(MatrixView<T> dst, ConstMortonView<T> src) {
+    if (dst.nRows == 0 || dst.nCols == 0) return;
+    if (src.levels == 0) {
+        for (size_t r = 0; r < dst.nRows; r++) {
+            const T *row = src.data + r*src.tileCols;
+            std::copy(row, row + dst.nCols, dst.row(r));
+        }
+        return;
+    }
+    size_t halfRows = src.getNRows() / 2, halfCols = src.getNCols() / 2;
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            fromMorton<T>(clip(dst, i*halfRows, j*halfCols, halfRows, halfCols), src.quadrant(i, j));
+        }
+    }
+}
+
+template <class T>
+void lab2::mortonWinogradMul(MortonView<T> dst, ConstMortonView<T> m1, ConstMortonView<T> m2,
+                             T *workspace) {
+    if (dst.levels == 0) {
+        kernels::mul<T>(dst.tile(), m1.tile(), m2.tile());
+        return;
+    }
+    ConstMortonView<T> A11 = m1.quadrant(0, 0), A12 = m1.quadrant(0, 1),
+                       A21 = m1.quadrant(1, 0), A22 = m1.quadrant(1, 1);
+    ConstMortonView<T> B11 = m2.quadrant(0, 0), B12 = m2.quadrant(0, 1),
+                       B21 = m2.quadrant(1, 0), B22 = m2.quadrant(1, 1);
+    MortonView<T> C11 = dst.quadrant(0, 0), C12 = dst.quadrant(0, 1),
+                  C21 = dst.quadrant(1, 0), C22 = dst.quadrant(1, 1);
+
+    // same temporaries as in winogradMul, laid out as quadrants of m1, dst and m2
+    MortonView<T> X{workspace, A11.tileRows, A11.tileCols, A11.levels};
+    MortonView<T> XP{workspace, C11.tileRows, C11.tileCols, C11.levels};
+    MortonView<T> Y{workspace + std::max(A11.size(), C11.size()), B11.tileRows, B11.tileCols, B11.levels};
+    T *deeper = Y.data + Y.size();
+
+    sum<T>(X, A11, A21, -1);                        // S3 = A11 - A21
+    sum<T>(Y, B22, B12, -1);                        // T3 = B22 - B12
+    mortonWinogradMul<T>(C21, X, Y, deeper);        // P7 = S3 * T3
+    sum<T>(X, A21, A22);                            // S1 = A21 + A22
+    sum<T>(Y, B12, B11, -1);                        // T1 = B12 - B11
+    mortonWinogradMul<T>(C22, X, Y, deeper);        // P5 = S1 * T1
+    sum<T>(X, X, A11, -1);                          // S2 = S1 - A11
+    sum<T>(Y, B22, Y, -1);                          // T2 = B22 - T1
+    mortonWinogradMul<T>(C12, X, Y, deeper);        // P6 = S2 * T2
+    sum<T>(X, A12, X, -1);                          // S4 = A12 - S2
+    mortonWinogradMul<T>(C11, X, B22, deeper);      // P3 = S4 * B22
+    mortonWinogradMul<T>(XP, A11, B11, deeper);     // P1 = A11 * B11
+    sum<T>(C12, XP, C12);                           // U2 = P1 + P6
+    sum<T>(C21, C12, C21);                          // U3 = U2 + P7
+    sum<T>(C12, C12, C22);                          // U4 = U2 + P5
+    sum<T>(C22, C21, C22);                          // U7 = U3 + P5  -> C22
+    sum<T>(C12, C12, C11);                          // U5 = U4 + P3  -> C12
+    sum<T>(Y, Y, B21, -1);                          // T4 = T2 - B21
+    mortonWinogradMul<T>(C11, A22, Y, deeper);      // P4 = A22 * T4
+    sum<T>(C21, C21, C11, -1);                      // U6 = U3 - P4  -> C21
+    mortonWinogradMul<T>(C11, A12, B21, deeper);    // P2 = A12 * B21
+    sum<T>(C11, XP, C11);                           // U1 = P1 + P2  -> C11
+}
+
+
+size_t lab2::mortonMulWorkspaceSize(size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    unsigned levels = mortonLevels(nRows, nInner, nCols, limit);
+    size_t m = mortonTileSize(nRows, levels), k = mortonTileSize(nInner, levels),
+           n = mortonTileSize(nCols, levels);
+    return ((m*k + k*n + m*n) << 2*levels) + mortonWorkspaceSize(m, k, n, levels);
+}
+
+template <class T>
+void lab2::mortonMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+                     T *workspace, size_t limit) {
+    unsigned levels = mortonLevels(m1.nRows, m1.nCols, m2.nCols, limit);
+    size_t m = mortonTileSize(m1.nRows, levels), k = mortonTileSize(m1.nCols, levels),
+           n = mortonTileSize(m2.nCols, levels);
+    MortonView<T> A{workspace, m, k, levels};
+    MortonView<T> B{A.data + A.size(), k, n, levels};
+    MortonView<T> C{B.data + B.size(), m, n, levels};
+    toMorton<T>(A, m1);
+    toMorton<T>(B, m2);
+    mortonWinogradMul<T>(C, A, B, C.data + C.size());
+    fromMorton<T>(dst, C);
+}
+
+
+#define INSTANTIATE_MORTON(T) \
+    template void lab2::toMorton<T>(lab2::MortonView<T>, lab2::ConstMatrixView<T>); \
+    template void lab2::fromMorton<T>(lab2::MatrixView<T>, lab2::ConstMortonView<T>); \
+    template void lab2::mortonWinogradMul<T>(lab2::MortonView<T>, lab2::ConstMortonView<T>, \
+                                             lab2::ConstMortonView<T>, T*); \
+    template void lab2::mortonMul<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                     lab2::ConstMatrixView<T>, T*, size_t);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_MORTON)
@@ -0,0 +1,84 @@
+#ifndef MTP_LAB1_MORTON_H
+#define MTP_LAB1_MORTON_H
+
+#include "MatrixView.h"
+
+
+namespace lab2 {
+
+// Matrix stored in blocked Z-order (Morton) layout: after `levels` halvings of both
+// dimensions the matrix is a grid of row-major tiles of tileRows x tileCols elements,
+// and quadrants are stored one after another (11, 12, 21, 22) recursively.
+// So every quadrant at every recursion level is a contiguous range of memory.
+template <class T>
+struct BasicMortonView {
+
+    T *data;
+    size_t tileRows, tileCols;
+    unsigned levels;
+
+    BasicMortonView(T *data, size_t tileRows, size_t tileCols, unsigned levels)
+            : data(data), tileRows(tileRows), tileCols(tileCols), levels(levels) {}
+
+    template <class U>
+    BasicMortonView(const BasicMortonView<U> &v)
+            : BasicMortonView(v.data, v.tileRows, v.tileCols, v.levels) {}
+
+    size_t getNRows() const { return tileRows << levels; }
+    size_t getNCols() const { return tileCols << levels; }
+    size_t size() const { return getNRows() * getNCols(); }
+
+    BasicMortonView quadrant(int i, int j) const {
+        return BasicMortonView(data + (2*i + j) * (size() / 4), tileRows, tileCols, levels - 1);
+    }
+
+    // the whole matrix as a row-major view, valid only when levels == 0
+    BasicMatrixView<T> tile() const { return BasicMatrixView<T>(data, tileRows, tileCols); }
+
+    // all elements as a single row, for element-wise kernels
+    BasicMatrixView<T> flat() const { return BasicMatrixView<T>(data, 1, size()); }
+
+};
+
+template <class T> using MortonView = BasicMortonView<T>;
+template <class T> using ConstMortonView = BasicMortonView<const T>;
+
+// Number of halvings of nRows x nInner by nInner x nCols multiplication before
+// the smallest dimension fits in `limit`, same leaf rule as for winogradMul
+unsigned mortonLevels(size_t nRows, size_t nInner, size_t nCols, size_t limit);
+
+// Dimension of a tile holding `size` elements split by `levels` halvings.
+// The matrix is padded with zeros up to tileSize(...) << levels.
+inline size_t mortonTileSize(size_t size, unsigned levels) {
+    return (size + (size_t(1) << levels) - 1) >> levels;
+}
+
+// Scratch memory used by mortonWinogradMul, in elements
+size_t mortonWorkspaceSize(size_t tileRows, size_t tileInner, size_t tileCols, unsigned levels);
+
+// Converts at the edges: row-major data is copied into Morton layout padded with zeros,
+// and back, where the padding is dropped
+template <class T>
+void toMorton(MortonView<T> dst, ConstMatrixView<T> src);
+
+template <class T>
+void fromMorton(MatrixView<T> dst, ConstMortonView<T> src);
+
+// Strassen-Winograd multiplication with the same schedule as winogradMul, all the
+// quadrant additions run over contiguous ranges and leaf products over contiguous tiles
+template <class T>
+void mortonWinogradMul(MortonView<T> dst, ConstMortonView<T> m1, ConstMortonView<T> m2,
+                       T *workspace);
+
+// Row-major in, row-major out: converts operands to Morton layout, multiplies them with
+// mortonWinogradMul and converts the result back. `workspace` must hold at least
+// mortonMulWorkspaceSize(...) elements, including the converted copies.
+size_t mortonMulWorkspaceSize(size_t nRows, size_t nInner, size_t nCols, size_t limit);
+
+template <class T>
+void mortonMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+               T *workspace, size_t limit);
+
+}
+
+#endif //MTP_LAB1_MORTON_H
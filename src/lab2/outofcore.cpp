@@ -0,0 +1,315 @@
+#include "outofcore.h"
+#include "kernels.h"
+#include "chain.h"
+#include "dtypes.h"
+#include "../mt/TaskGraph.h"
+#include "../matfile/TextMatrix.h"
+#include <list>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+
+namespace {
+
+using matfile::TiledMatrixFile;
+
+// Tiles of tiled files kept in memory; when they take more than the budget, the least
+// recently used ones are dropped. Tiles held by callers are never dropped, so the cache
+// goes beyond its budget when these alone do not fit in it.
+template <class T>
+class TileCache {
+
+public:
+
+    typedef std::shared_ptr<const std::vector<T>> Tile;
+
+    explicit TileCache(size_t memoryBudget) : _memoryBudget(memoryBudget), _memoryInUse(0) {}
+
+    Tile get(const TiledMatrixFile &file, size_t tileRow, size_t tileCol) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> _lk{_mtx};
+            Key key{&file, tileRow, tileCol};
+            auto it = _index.find(key);
+            if (it != _index.end()) {
+                _lru.splice(_lru.begin(), _lru, it->second);
+                entry = it->second->second;
+            } else {
+                entry = std::make_shared<Entry>();
+                entry->bytes = file.getTileBytes();
+                _lru.emplace_front(key, entry);
+                _index[key] = _lru.begin();
+                _memoryInUse += entry->bytes;
+                evict();
+            }
+        }
+        // tiles are read outside of the cache lock, so that threads load them in parallel
+        std::unique_lock<std::mutex> _lk{entry->mtx};
+        if (!entry->loaded) {
+            entry->data.resize(file.getTileSize()*file.getTileSize());
+            file.readTile(tileRow, tileCol, entry->data.data());
+            entry->loaded = true;
+        }
+        return Tile(entry, &entry->data);
+    }
+
+private:
+    struct Entry {
+        std::vector<T> data;
+        size_t bytes = 0;
+        bool loaded = false;
+        std::mutex mtx;
+    };
+    typedef std::tuple<const TiledMatrixFile*, size_t, size_t> Key;
+    typedef std::list<std::pair<Key, std::shared_ptr<Entry>>> LruList;
+
+    const size_t _memoryBudget;
+    size_t _memoryInUse;
+    LruList _lru;       // most recently used first
+    std::map<Key, typename LruList::iterator> _index;
+    std::mutex _mtx;
+
+    void evict() {
+        auto it = _lru.end();
+        while (_memoryInUse > _memoryBudget && it != _lru.begin()) {
+            --it;
+            if (it->second.use_count() > 1) continue;   // held by some caller
+            _memoryInUse -= it->second->bytes;
+            _index.erase(it->first);
+            it = _lru.erase(it);
+        }
+    }
+
+};
+
+
+// State shared by the tasks computing one tiled product
+template <class T>
+struct TiledProduct {
+    const TiledMatrixFile &m1, &m2;
+    TiledMatrixFile &result;
+    TileCache<T> cache;
+
+    std::mutex errorMtx;
+    std::string error;
+
+    TiledProduct(const TiledMatrixFile &m1, const TiledMatrixFile &m2, TiledMatrixFile &result,
+                 size_t cacheBudget)
+            : m1(m1), m2(m2), result(result), cache(cacheBudget) {}
+};
+
+// Computes one tile of the product, a step along the inner dimension per portion
+template <class T>
+class TileProductTask : public mt::Task {
+
+    TiledProduct<T> &_product;
+    const size_t _tileRow, _tileCol;
+    size_t _step;
+    std::vector<T> _sum;
+
+public:
+
+    TileProductTask(TiledProduct<T> &product, size_t tileRow, size_t tileCol)
+            : _product(product), _tileRow(tileRow), _tileCol(tileCol), _step(0) {}
+
+    bool isWaiting() override { return false; }
+
+protected:
+
+    bool doStart(const std::vector<mt::Task*> &dependencies) override {
+        _step = 0;
+        return false;
+    }
+
+    bool doWorkPortion() override {
+        size_t n = _product.result.getTileSize();
+        size_t nSteps = _product.m1.getNTileCols();
+        try {
+            if (_step == 0) _sum.assign(n*n, T(0));
+            // the kernel reads the next tiles from disk while these ones are multiplied
+            if (_step + 1 < nSteps) {
+                _product.m1.prefetchTile(_tileRow, _step + 1);
+                _product.m2.prefetchTile(_step + 1, _tileCol);
+            }
+            auto a = _product.cache.get(_product.m1, _tileRow, _step);
+            auto b = _product.cache.get(_product.m2, _step, _tileCol);
+            lab2::kernels::mulAdd<T>(lab2::MatrixView<T>(_sum.data(), n, n),
+                                     lab2::ConstMatrixView<T>(a->data(), n, n),
+                                     lab2::ConstMatrixView<T>(b->data(), n, n));
+            if (++_step < nSteps) return false;
+            _product.result.writeTile(_tileRow, _tileCol, _sum.data());
+        } catch (const std::runtime_error &err) {
+            std::unique_lock<std::mutex> _lk{_product.errorMtx};
+            _product.error = err.what();
+        }
+        return true;
+    }
+
+    void doFinalize() override {
+        _sum.clear();
+        _sum.shrink_to_fit();
+    }
+
+};
+
+
+// Parameters of an out-of-core chain product
+struct ChainJob {
+    const std::vector<std::string> &inNames;
+    const std::vector<size_t> &dims;
+    const lab2::ChainPlan &plan;
+    const std::string &scratchDir;
+    size_t tileSize;
+    unsigned nThreads;
+    size_t cacheBudget;
+};
+
+// Scratch files are removed from their directory right after creation,
+// so that they disappear when closed, even if the process is killed
+template <class T>
+std::unique_ptr<TiledMatrixFile> createScratchFile(const ChainJob &job, const std::string &name,
+                                                   size_t nRows, size_t nCols) {
+    std::string path = job.scratchDir + "/lab2-" + std::to_string(getpid()) + "-" + name + ".tiles";
+    std::unique_ptr<TiledMatrixFile> file{
+            new TiledMatrixFile(path, nRows, nCols, job.tileSize, matfile::DTypeOf<T>::value)};
+    file->remove();
+    return file;
+}
+
+// product of matrices first..last in the order of the plan, subchains one after another
+template <class T>
+std::unique_ptr<TiledMatrixFile> multiplySubchain(const ChainJob &job, size_t first, size_t last) {
+    if (first == last) {
+        auto input = createScratchFile<T>(job, "input" + std::to_string(first),
+                                          job.dims[first], job.dims[first + 1]);
+        lab2::toTiled<T>(job.inNames[first], *input);
+        return input;
+    }
+    size_t split = job.plan.getSplit(first, last);
+    auto left = multiplySubchain<T>(job, first, split);
+    auto right = multiplySubchain<T>(job, split + 1, last);
+    auto result = createScratchFile<T>(job, "product" + std::to_string(first) + "-" + std::to_string(last),
+                                       job.dims[first], job.dims[last + 1]);
+    lab2::multiplyTiled<T>(*left, *right, *result, job.nThreads, job.cacheBudget);
+    return result;
+}
+
+}
+
+
+template <class T>
+void lab2::toTiled(const std::string &inName, matfile::TiledMatrixFile &dst) {
+    size_t n = dst.getTileSize(), nRows = dst.getNRows(), nCols = dst.getNCols();
+    std::unique_ptr<matfile::MappedMatrix> binary;
+    std::unique_ptr<matfile::TextMatrixReader> text;
+    if (matfile::isMatrixFile(inName)) {
+        binary.reset(new matfile::MappedMatrix(inName));
+        if (binary->getNRows() != nRows || binary->getNCols() != nCols) {
+            throw std::runtime_error(inName + " has other dimensions");
+        }
+    } else {
+        text.reset(new matfile::TextMatrixReader(inName));
+    }
+
+    // a band of rows is read at once and split into tiles
+    std::vector<T> band(n*nCols), tile(n*n);
+    for (size_t tileRow = 0; tileRow < dst.getNTileRows(); tileRow++) {
+        size_t rowBegin = tileRow*n, bandRows = std::min(n, nRows - rowBegin);
+        if (binary) {
+            binary->copyRows(band.data(), rowBegin, bandRows);
+        } else {
+            text->read(band.data(), bandRows*nCols);
+        }
+        for (size_t tileCol = 0; tileCol < dst.getNTileCols(); tileCol++) {
+            size_t colBegin = tileCol*n, tileCols = std::min(n, nCols - colBegin);
+            std::fill(tile.begin(), tile.end(), T(0));
+            for (size_t r = 0; r < bandRows; r++) {
+                const T *row = band.data() + r*nCols + colBegin;
+                std::copy(row, row + tileCols, tile.data() + r*n);
+            }
+            dst.writeTile(tileRow, tileCol, tile.data());
+        }
+    }
+}
+
+template <class T>
+void lab2::fromTiled(const matfile::TiledMatrixFile &src, const std::string &outName,
+                     matfile::Format format, unsigned nThreads) {
+    size_t n = src.getTileSize(), nRows = src.getNRows(), nCols = src.getNCols();
+    matfile::MatrixFileWriter out{outName, format};
+    std::vector<T> band(n*nCols), tile(n*n);
+    for (size_t tileRow = 0; tileRow < src.getNTileRows(); tileRow++) {
+        size_t bandRows = std::min(n, nRows - tileRow*n);
+        for (size_t tileCol = 0; tileCol < src.getNTileCols(); tileCol++) {
+            size_t colBegin = tileCol*n, tileCols = std::min(n, nCols - colBegin);
+            src.readTile(tileRow, tileCol, tile.data());
+            for (size_t r = 0; r < bandRows; r++) {
+                std::copy(tile.data() + r*n, tile.data() + r*n + tileCols, band.data() + r*nCols + colBegin);
+            }
+        }
+        out.writeRows(band.data(), bandRows, nCols, nCols, nThreads);
+    }
+    out.close();
+}
+
+template <class T>
+void lab2::multiplyTiled(const matfile::TiledMatrixFile &m1, const matfile::TiledMatrixFile &m2,
+                         matfile::TiledMatrixFile &result, unsigned nThreads, size_t cacheBudget) {
+    for (const TiledMatrixFile *file : {&m1, &m2, const_cast<const TiledMatrixFile*>(&result)}) {
+        if (file->getDType() != matfile::DTypeOf<T>::value || file->getTileSize() != result.getTileSize()) {
+            throw std::runtime_error("Tiles of " + file->getPath() + " do not match the product");
+        }
+    }
+    if (m1.getNCols() != m2.getNRows() || m1.getNRows() != result.getNRows()
+        || m2.getNCols() != result.getNCols()) {
+        throw std::runtime_error("Cannot multiply " + m1.getPath() + " by " + m2.getPath());
+    }
+
+    TiledProduct<T> product{m1, m2, result, cacheBudget};
+    mt::TaskGraph graph;
+    std::vector<std::unique_ptr<TileProductTask<T>>> tasks;
+    // row after row, so that tiles of a row of m1 are reused from the cache
+    for (size_t i = 0; i < result.getNTileRows(); i++) {
+        for (size_t j = 0; j < result.getNTileCols(); j++) {
+            tasks.emplace_back(new TileProductTask<T>(product, i, j));
+            graph.addTask(tasks.back().get(), {});
+        }
+    }
+    graph.runAll(nThreads);
+    if (!product.error.empty()) throw std::runtime_error(product.error);
+}
+
+template <class T>
+void lab2::multiplyChainOutOfCore(const std::vector<std::string> &inNames, const std::string &outName,
+                                  matfile::Format outFormat, const std::vector<size_t> &dims,
+                                  const std::string &scratchDir, size_t tileSize,
+                                  unsigned nThreads, size_t cacheBudget) {
+    // products are computed one at a time, so the plan just minimizes the work
+    ChainPlan plan{dims, 1, [] (size_t nRows, size_t nInner, size_t nCols) {
+        double work = 2.0*nRows*nInner*nCols;
+        return ProductCost{work, work};
+    }};
+    // no point in padding all tiles beyond the largest matrix
+    tileSize = std::min(tileSize, *std::max_element(dims.begin(), dims.end()));
+    ChainJob job{inNames, dims, plan, scratchDir, tileSize, nThreads, cacheBudget};
+    auto product = multiplySubchain<T>(job, 0, inNames.size() - 1);
+    fromTiled<T>(*product, outName, outFormat, nThreads);
+}
+
+
+#define INSTANTIATE_OUT_OF_CORE(T) \
+    template void lab2::toTiled<T>(const std::string&, matfile::TiledMatrixFile&); \
+    template void lab2::fromTiled<T>(const matfile::TiledMatrixFile&, const std::string&, \
+                                     matfile::Format, unsigned); \
+    template void lab2::multiplyTiled<T>(const matfile::TiledMatrixFile&, const matfile::TiledMatrixFile&, \
+                                         matfile::TiledMatrixFile&, unsigned, size_t); \
+    template void lab2::multiplyChainOutOfCore<T>(const std::vector<std::string>&, const std::string&, \
+                                                  matfile::Format, const std::vector<size_t>&, \
+                                                  const std::string&, size_t, unsigned, size_t);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_OUT_OF_CORE)
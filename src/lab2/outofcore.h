@@ -0,0 +1,42 @@
+#ifndef MTP_LAB1_OUTOFCORE_H
+#define MTP_LAB1_OUTOFCORE_H
+
+#include <string>
+#include <vector>
+#include "../matfile/TiledMatrixFile.h"
+#include "../matfile/MatrixFileWriter.h"
+
+
+// Out-of-core multiplication for matrices larger than memory: operands and intermediate
+// products are kept as tiled scratch files on disk, and tiles are streamed through a cache
+// of bounded size. Each output tile is computed by its own TaskGraph task, which asks
+// the kernel to read ahead the tiles of its next step while multiplying the current ones.
+// All functions throw std::runtime_error on I/O errors and malformed inputs.
+namespace lab2 {
+
+// Converts a text or binary row-major matrix file into a tiled file of the same shape
+template <class T>
+void toTiled(const std::string &inName, matfile::TiledMatrixFile &dst);
+
+// Writes a tiled matrix into a text or binary row-major file
+template <class T>
+void fromTiled(const matfile::TiledMatrixFile &src, const std::string &outName,
+               matfile::Format format, unsigned nThreads);
+
+// result = m1 * m2 on nThreads threads, reading tiles through a cache of cacheBudget bytes;
+// all files must have the same tile size
+template <class T>
+void multiplyTiled(const matfile::TiledMatrixFile &m1, const matfile::TiledMatrixFile &m2,
+                   matfile::TiledMatrixFile &result, unsigned nThreads, size_t cacheBudget);
+
+// Multiplies the chain of matrices from inNames with dimensions dims (as for ChainPlan)
+// keeping tiles of tileSize x tileSize in scratchDir, and writes the product to outName
+template <class T>
+void multiplyChainOutOfCore(const std::vector<std::string> &inNames, const std::string &outName,
+                            matfile::Format outFormat, const std::vector<size_t> &dims,
+                            const std::string &scratchDir, size_t tileSize,
+                            unsigned nThreads, size_t cacheBudget);
+
+}
+
+#endif //MTP_LAB1_OUTOFCORE_H
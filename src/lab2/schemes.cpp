@@ -0,0 +1,357 @@
+#include "schemes.h"
+#include "kernels.h"
+#include "dtypes.h"
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+#include <stdexcept>
+
+
+namespace {
+
+using lab2::BilinearScheme;
+
+// Parses a linear form like "A11-A21+2*A22" into dense vector of coefficients.
+// Variables having two-digit indices (A and B) are addressed as [i][j] in a grid
+// with `nCols` columns, variables with single index (P) are addressed directly.
+std::vector<float> parseForm(const std::string &formula, char var, size_t size, size_t nCols) {
+    std::vector<float> coeffs(size, 0);
+    auto bad = [&formula] () {
+        return std::runtime_error("Bad scheme formula: " + formula);
+    };
+    size_t pos = 0;
+    while (pos < formula.size()) {
+        float coeff = 1;
+        if (formula[pos] == '+' || formula[pos] == '-') {
+            if (formula[pos] == '-') coeff = -1;
+            pos++;
+        }
+        if (pos < formula.size() && std::isdigit(formula[pos])) {
+            size_t len = 0;
+            coeff *= std::stof(formula.substr(pos), &len);
+            pos += len;
+            if (pos >= formula.size() || formula[pos] != '*') throw bad();
+            pos++;
+        }
+        if (pos >= formula.size() || formula[pos] != var) throw bad();
+        pos++;
+        size_t start = pos;
+        while (pos < formula.size() && std::isdigit(formula[pos])) pos++;
+        std::string digits = formula.substr(start, pos - start);
+        size_t idx;
+        if (nCols > 0) {
+            if (digits.size() != 2) throw bad();
+            idx = (size_t)(digits[0] - '1') * nCols + (size_t)(digits[1] - '1');
+        } else {
+            if (digits.empty()) throw bad();
+            idx = std::stoul(digits) - 1;
+        }
+        if (idx >= size) throw bad();
+        coeffs[idx] += coeff;
+    }
+    return coeffs;
+}
+
+std::map<std::string, BilinearScheme> makeBuiltins() {
+    std::map<std::string, BilinearScheme> builtins;
+
+    // plain recursive block multiplication, useful as a baseline
+    builtins["naive"] = BilinearScheme::fromFormulas("naive", 2, 2, 2, {
+            "A11", "B11",    "A12", "B21",    "A11", "B12",    "A12", "B22",
+            "A21", "B11",    "A22", "B21",    "A21", "B12",    "A22", "B22",
+    }, {
+            "P1+P2", "P3+P4",
+            "P5+P6", "P7+P8",
+    });
+
+    builtins["strassen"] = BilinearScheme::fromFormulas("strassen", 2, 2, 2, {
+            "A11+A22", "B11+B22",
+            "A21+A22", "B11",
+            "A11",     "B12-B22",
+            "A22",     "B21-B11",
+            "A11+A12", "B22",
+            "A21-A11", "B11+B12",
+            "A12-A22", "B21+B22",
+    }, {
+            "P1+P4-P5+P7", "P3+P5",
+            "P2+P4",       "P1-P2+P3+P6",
+    });
+
+    // Winograd's variant written as plain products; the shared partial sums that
+    // bring it down to 15 additions are exploited by matmulWinograd/winogradMul
+    builtins["winograd"] = BilinearScheme::fromFormulas("winograd", 2, 2, 2, {
+            "A11",             "B11",
+            "A12",             "B21",
+            "A11+A12-A21-A22", "B22",
+            "A22",             "B11-B12-B21+B22",
+            "A21+A22",         "B12-B11",
+            "A21+A22-A11",     "B11-B12+B22",
+            "A11-A21",         "B22-B12",
+    }, {
+            "P1+P2",       "P1+P3+P5+P6",
+            "P1-P4+P6+P7", "P1+P5+P6+P7",
+    });
+
+    // J. Laderman, "A noncommutative algorithm for multiplying 3x3 matrices
+    // using 23 multiplications", 1976
+    builtins["laderman"] = BilinearScheme::fromFormulas("laderman", 3, 3, 3, {
+            "A11+A12+A13-A21-A22-A32-A33", "B22",
+            "A11-A21",                     "B22-B12",
+            "A22",                         "B12+B21+B33-B11-B22-B23-B31",
+            "A21+A22-A11",                 "B11-B12+B22",
+            "A21+A22",                     "B12-B11",
+            "A11",                         "B11",
+            "A31+A32-A11",                 "B11-B13+B23",
+            "A31-A11",                     "B13-B23",
+            "A31+A32",                     "B13-B11",
+            "A11+A12+A13-A22-A23-A31-A32", "B23",
+            "A32",                         "B13+B21+B32-B11-B22-B23-B31",
+            "A32+A33-A13",                 "B22+B31-B32",
+            "A13-A33",                     "B22-B32",
+            "A13",                         "B31",
+            "A32+A33",                     "B32-B31",
+            "A22+A23-A13",                 "B23+B31-B33",
+            "A13-A23",                     "B23-B33",
+            "A22+A23",                     "B33-B31",
+            "A12",                         "B21",
+            "A23",                         "B32",
+            "A21",                         "B13",
+            "A31",                         "B12",
+            "A33",                         "B33",
+    }, {
+            "P6+P14+P19",              "P1+P4+P5+P6+P12+P14+P15",  "P6+P7+P9+P10+P14+P16+P18",
+            "P2+P3+P4+P6+P14+P16+P17", "P2+P4+P5+P6+P20",          "P14+P16+P17+P18+P21",
+            "P6+P7+P8+P11+P12+P13+P14","P12+P13+P14+P15+P22",      "P6+P7+P8+P9+P23",
+    });
+
+    for (const auto &entry : builtins) entry.second.validate();
+    return builtins;
+}
+
+std::map<std::string, BilinearScheme>& registry() {
+    static std::map<std::string, BilinearScheme> schemes = makeBuiltins();
+    return schemes;
+}
+
+const BilinearScheme* findScheme(const std::string &name) {
+    auto &schemes = registry();
+    auto it = schemes.find(name);
+    if (it != schemes.end()) return &it->second;
+
+    size_t star = name.rfind('*');
+    if (star == std::string::npos) {
+        throw std::runtime_error("Unknown multiplication scheme: " + name);
+    }
+    const BilinearScheme *outer = findScheme(name.substr(0, star));
+    const BilinearScheme *inner = findScheme(name.substr(star + 1));
+    BilinearScheme composed = BilinearScheme::compose(*outer, *inner);
+    composed.name = name;
+    return &(schemes[name] = composed);
+}
+
+// Computes linear combination of blocks of `m` into `tmp`,
+// or returns the block itself if no arithmetic is needed.
+template <class T>
+lab2::ConstMatrixView<T> combineBlocks(lab2::MatrixView<T> tmp, lab2::ConstMatrixView<T> m,
+                                       size_t nBlockRows, size_t nBlockCols,
+                                       const std::vector<float> &coeffs) {
+    size_t blockRows = m.nRows / nBlockRows, blockCols = m.nCols / nBlockCols;
+    size_t nTerms = 0, lastTerm = 0;
+    for (size_t i = 0; i < coeffs.size(); i++) {
+        if (coeffs[i] != 0) {
+            nTerms++;
+            lastTerm = i;
+        }
+    }
+    auto block = [&] (size_t idx) {
+        return m.block((idx / nBlockCols) * blockRows, (idx % nBlockCols) * blockCols,
+                       blockRows, blockCols);
+    };
+    if (nTerms == 1 && coeffs[lastTerm] == 1) return block(lastTerm);
+
+    bool first = true;
+    for (size_t i = 0; i < coeffs.size(); i++) {
+        if (coeffs[i] == 0) continue;
+        if (first) lab2::kernels::scale<T>(tmp, block(i), (T)coeffs[i]);
+        else lab2::kernels::sum<T>(tmp, tmp, block(i), (T)coeffs[i]);
+        first = false;
+    }
+    return tmp;
+}
+
+}
+
+
+BilinearScheme
+lab2::BilinearScheme::fromFormulas(const std::string &name, size_t m, size_t k, size_t n,
+                                   const std::vector<std::string> &factors,
+                                   const std::vector<std::string> &results) {
+    if (factors.size() % 2 != 0 || results.size() != m*n) {
+        throw std::runtime_error("Bad number of formulas for scheme " + name);
+    }
+    BilinearScheme scheme;
+    scheme.name = name;
+    scheme.m = m;
+    scheme.k = k;
+    scheme.n = n;
+    scheme.rank = factors.size() / 2;
+    for (size_t r = 0; r < scheme.rank; r++) {
+        scheme.U.push_back(parseForm(factors[2*r],     'A', m*k, k));
+        scheme.V.push_back(parseForm(factors[2*r + 1], 'B', k*n, n));
+    }
+    for (const auto &formula : results) {
+        scheme.W.push_back(parseForm(formula, 'P', scheme.rank, 0));
+    }
+    return scheme;
+}
+
+BilinearScheme
+lab2::BilinearScheme::compose(const BilinearScheme &outer, const BilinearScheme &inner) {
+    BilinearScheme scheme;
+    scheme.name = outer.name + "*" + inner.name;
+    scheme.m = outer.m * inner.m;
+    scheme.k = outer.k * inner.k;
+    scheme.n = outer.n * inner.n;
+    scheme.rank = outer.rank * inner.rank;
+
+    // block (i2, j2) of outer block (i1, j1) has index (i1*inner.rows + i2, j1*inner.cols + j2)
+    auto kron = [] (const std::vector<float> &o, const std::vector<float> &in,
+                    size_t oCols, size_t inRows, size_t inCols) {
+        std::vector<float> result(o.size() * in.size(), 0);
+        size_t cols = oCols * inCols;
+        for (size_t a = 0; a < o.size(); a++) {
+            for (size_t b = 0; b < in.size(); b++) {
+                size_t row = (a / oCols) * inRows + b / inCols;
+                size_t col = (a % oCols) * inCols + b % inCols;
+                result[row*cols + col] = o[a] * in[b];
+            }
+        }
+        return result;
+    };
+
+    for (size_t r1 = 0; r1 < outer.rank; r1++) {
+        for (size_t r2 = 0; r2 < inner.rank; r2++) {
+            scheme.U.push_back(kron(outer.U[r1], inner.U[r2], outer.k, inner.m, inner.k));
+            scheme.V.push_back(kron(outer.V[r1], inner.V[r2], outer.n, inner.k, inner.n));
+        }
+    }
+    scheme.W.assign(scheme.m * scheme.n, std::vector<float>(scheme.rank, 0));
+    for (size_t c1 = 0; c1 < outer.m * outer.n; c1++) {
+        for (size_t c2 = 0; c2 < inner.m * inner.n; c2++) {
+            size_t row = (c1 / outer.n) * inner.m + c2 / inner.n;
+            size_t col = (c1 % outer.n) * inner.n + c2 % inner.n;
+            for (size_t r1 = 0; r1 < outer.rank; r1++) {
+                for (size_t r2 = 0; r2 < inner.rank; r2++) {
+                    scheme.W[row*scheme.n + col][r1*inner.rank + r2] =
+                            outer.W[c1][r1] * inner.W[c2][r2];
+                }
+            }
+        }
+    }
+    return scheme;
+}
+
+void lab2::BilinearScheme::validate() const {
+    if (U.size() != rank || V.size() != rank || W.size() != m*n) {
+        throw std::runtime_error("Scheme " + name + " has inconsistent tables");
+    }
+    // sum_r U[r][(i,j)] * V[r][(p,q)] * W[(s,t)][r] must be 1 when A[i][j]*B[p][q]
+    // contributes to C[s][t] (that is j == p, i == s, q == t), and 0 otherwise
+    for (size_t a = 0; a < m*k; a++) {
+        for (size_t b = 0; b < k*n; b++) {
+            for (size_t c = 0; c < m*n; c++) {
+                float total = 0;
+                for (size_t r = 0; r < rank; r++) {
+                    total += U[r][a] * V[r][b] * W[c][r];
+                }
+                bool expected = a % k == b / n && a / k == c / n && b % n == c % n;
+                if (std::fabs(total - (expected ? 1 : 0)) > 1e-5) {
+                    throw std::runtime_error("Scheme " + name + " does not compute matrix product");
+                }
+            }
+        }
+    }
+}
+
+bool lab2::BilinearScheme::isIntegral() const {
+    for (const auto *table : {&U, &V, &W}) {
+        for (const auto &row : *table) {
+            for (float coeff : row) {
+                if (coeff != std::round(coeff)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+lab2::SchemeList lab2::parseSchemeList(const std::string &spec) {
+    SchemeList schemes;
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        // compositions of valid schemes are valid, so only builtins are validated
+        schemes.push_back(findScheme(spec.substr(start, end - start)));
+        start = end + 1;
+    }
+    return schemes;
+}
+
+bool lab2::isSchemeLeaf(const BilinearScheme &scheme,
+                        size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    return std::min(nRows, std::min(nInner, nCols)) <= limit
+           || nRows < scheme.m || nInner < scheme.k || nCols < scheme.n;
+}
+
+size_t lab2::schemeWorkspaceSize(const SchemeList &schemes, size_t level,
+                                 size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    const auto &scheme = schemeAt(schemes, level);
+    if (isSchemeLeaf(scheme, nRows, nInner, nCols, limit)) return 0;
+    // peeled rows and columns are handled without extra memory
+    size_t m = nRows / scheme.m, k = nInner / scheme.k, n = nCols / scheme.n;
+    return m*k + k*n + m*n + schemeWorkspaceSize(schemes, level + 1, m, k, n, limit);
+}
+
+template <class T>
+void lab2::schemeMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+                     const SchemeList &schemes, size_t level,
+                     T *workspace, size_t limit) {
+    const auto &scheme = schemeAt(schemes, level);
+    if (isSchemeLeaf(scheme, m1.nRows, m1.nCols, m2.nCols, limit)) {
+        kernels::mul<T>(dst, m1, m2);
+        return;
+    }
+    if (kernels::peel<T>(dst, m1, m2, scheme.m, scheme.k, scheme.n,
+                         [&] (MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+                             schemeMul<T>(dst, m1, m2, schemes, level, workspace, limit);
+                         })) {
+        return;
+    }
+    size_t m = m1.nRows / scheme.m, k = m1.nCols / scheme.k, n = m2.nCols / scheme.n;
+    MatrixView<T> X{workspace, m, k};
+    MatrixView<T> Y{X.data + m*k, k, n};
+    MatrixView<T> P{Y.data + k*n, m, n};
+    T *deeper = P.data + m*n;
+
+    kernels::fill<T>(dst, 0);
+    for (size_t r = 0; r < scheme.rank; r++) {
+        ConstMatrixView<T> left = combineBlocks<T>(X, m1, scheme.m, scheme.k, scheme.U[r]);
+        ConstMatrixView<T> right = combineBlocks<T>(Y, m2, scheme.k, scheme.n, scheme.V[r]);
+        schemeMul<T>(P, left, right, schemes, level + 1, deeper, limit);
+        for (size_t c = 0; c < scheme.m * scheme.n; c++) {
+            float coeff = scheme.W[c][r];
+            if (coeff == 0) continue;
+            MatrixView<T> C = dst.block((c / scheme.n) * m, (c % scheme.n) * n, m, n);
+            kernels::sum<T>(C, C, P, (T)coeff);
+        }
+    }
+}
+
+
+#define INSTANTIATE_SCHEME_MUL(T) \
+    template void lab2::schemeMul<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                     lab2::ConstMatrixView<T>, const lab2::SchemeList&, size_t, \
+                                     T*, size_t);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_SCHEME_MUL)
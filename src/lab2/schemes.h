@@ -0,0 +1,69 @@
+#ifndef MTP_LAB1_SCHEMES_H
+#define MTP_LAB1_SCHEMES_H
+
+#include <string>
+#include <vector>
+#include "MatrixView.h"
+
+
+namespace lab2 {
+
+// Bilinear algorithm that multiplies (m x k) block matrix A by (k x n) block matrix B
+// using `rank` block products:
+//     P[r] = (sum U[r][i*k + j] * A[i][j]) * (sum V[r][i*n + j] * B[i][j])
+//     C[i][j] = sum W[i*n + j][r] * P[r]
+class BilinearScheme {
+
+public:
+
+    std::string name;
+    size_t m, k, n, rank;
+    std::vector<std::vector<float>> U, V, W;
+
+    // builds a scheme from textual formulas, e.g. for Strassen's P1 factors are
+    // "A11+A22" and "B11+B22", and C11 is "P1+P4-P5+P7" (all indices are 1-based)
+    static BilinearScheme fromFormulas(const std::string &name, size_t m, size_t k, size_t n,
+                                       const std::vector<std::string> &factors,
+                                       const std::vector<std::string> &results);
+
+    // scheme that applies `outer` to blocks and `inner` inside each block product
+    static BilinearScheme compose(const BilinearScheme &outer, const BilinearScheme &inner);
+
+    // checks Brent equations, throws std::runtime_error if scheme is not a matrix product
+    void validate() const;
+
+    // whether all coefficients are integers, so that the scheme works for integer matrices
+    bool isIntegral() const;
+
+};
+
+typedef std::vector<const BilinearScheme*> SchemeList;
+
+// Resolves comma-separated list of scheme names, one for each recursion level;
+// the last scheme is repeated for deeper levels. "a*b" stands for composition of
+// schemes a and b. Builtin names are: naive, strassen, winograd, laderman.
+SchemeList parseSchemeList(const std::string &spec);
+
+// Scheme used at given level of recursion
+inline const BilinearScheme& schemeAt(const SchemeList &schemes, size_t level) {
+    return *schemes[level < schemes.size() ? level : schemes.size()-1];
+}
+
+// Whether recursion stops at given dimensions with given scheme
+bool isSchemeLeaf(const BilinearScheme &scheme,
+                  size_t nRows, size_t nInner, size_t nCols, size_t limit);
+
+// Number of elements of scratch memory needed by schemeMul
+size_t schemeWorkspaceSize(const SchemeList &schemes, size_t level,
+                           size_t nRows, size_t nInner, size_t nCols, size_t limit);
+
+// Sequential multiplication following the schemes starting from given recursion level.
+// Needs three temporaries per level, all taken from `workspace`.
+template <class T>
+void schemeMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+               const SchemeList &schemes, size_t level,
+               T *workspace, size_t limit);
+
+}
+
+#endif //MTP_LAB1_SCHEMES_H
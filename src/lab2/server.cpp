@@ -0,0 +1,243 @@
+#include "server.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace {
+
+const size_t MAX_FDS_PER_MESSAGE = 64;
+// a client has this long to send its whole request, so that a stuck one does not
+// hold up the jobs of the others
+const int REQUEST_TIMEOUT_SECONDS = 10;
+
+sockaddr_un makeAddress(const std::string &socketPath) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path is too long: " + socketPath);
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    return address;
+}
+
+int connectTo(const std::string &socketPath) {
+    sockaddr_un address = makeAddress(socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool sendAll(int fd, const std::string &text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+bool isComplete(const std::string &request) {
+    return request == "\n" || (request.size() >= 2 && request.compare(request.size() - 2, 2, "\n\n") == 0);
+}
+
+// reads a request with descriptors passed along with it, false on errors
+bool receiveRequest(int conn, std::string &request, std::vector<int> &fds) {
+    timeval timeout{REQUEST_TIMEOUT_SECONDS, 0};
+    if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+        || setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+        return false;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(REQUEST_TIMEOUT_SECONDS);
+    char buffer[4096];
+    while (!isComplete(request)) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        iovec iov{buffer, sizeof(buffer)};
+        union {
+            cmsghdr header;
+            char data[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+        } control;
+        msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data;
+        msg.msg_controllen = sizeof(control.data);
+        ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; i++) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(c) + i*sizeof(int), sizeof(int));
+                fds.push_back(fd);
+            }
+        }
+        if (n == 0) break;
+        request.append(buffer, (size_t)n);
+    }
+    return true;
+}
+
+// "fd:<i>" turns into a path opening the i-th passed descriptor
+void resolveName(std::string &name, const std::vector<int> &fds) {
+    if (name.compare(0, 3, "fd:") != 0) return;
+    size_t pos = 0;
+    unsigned long index = fds.size();
+    try {
+        index = std::stoul(name.substr(3), &pos);
+    } catch (const std::logic_error&) {}
+    if (index >= fds.size() || pos != name.size() - 3) {
+        throw std::runtime_error("No file descriptor passed for " + name);
+    }
+    name = "/proc/self/fd/" + std::to_string(fds[index]);
+}
+
+std::string absolutePath(const std::string &name) {
+    if (name.empty() || name[0] == '/' || name.compare(0, 3, "fd:") == 0) return name;
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) return name;
+    return std::string(cwd) + "/" + name;
+}
+
+std::string handleRequest(const std::string &request, const std::vector<int> &fds,
+                          const lab2::JobRunner &runner,
+                          std::chrono::steady_clock::time_point arrival) {
+    std::stringstream reply;
+    std::vector<lab2::ChainJob> jobs;
+    try {
+        std::stringstream ss{request};
+        jobs = lab2::readBatch(ss, "request");
+        for (auto &job : jobs) {
+            for (auto &name : job.inNames) resolveName(name, fds);
+            resolveName(job.outName, fds);
+        }
+    } catch (const std::runtime_error &err) {
+        reply << "error " << err.what() << "\ndone 0 0\n";
+        return reply.str();
+    }
+    using namespace std::chrono;
+    double handedOver = duration_cast<duration<double>>(steady_clock::now() - arrival).count();
+    std::vector<lab2::JobResult> results = runner(jobs);
+    double total = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!results[i].error.empty()) {
+            reply << "error " << results[i].error << '\n';
+            continue;
+        }
+        // results count from the call of runner, replies from the arrival of the request
+        double seconds = results[i].seconds + handedOver;
+        total = std::max(total, seconds);
+        reply << "ok " << seconds << ' ' << jobs[i].outName << '\n';
+    }
+    total = std::max(total, duration_cast<duration<double>>(steady_clock::now() - arrival).count());
+    reply << "done " << jobs.size() << ' ' << total << '\n';
+    return reply.str();
+}
+
+}
+
+
+void lab2::serve(const std::string &socketPath, const JobRunner &runner) {
+    sockaddr_un address = makeAddress(socketPath);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) throw std::runtime_error("Cannot create socket");
+    // probe for a server which is still running there
+    int running = connectTo(socketPath);
+    if (running >= 0) {
+        close(running);
+        close(listener);
+        throw std::runtime_error("A server is already serving on " + socketPath);
+    }
+    // a socket left by a server which did not stop cleanly
+    unlink(socketPath.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listener, 64) != 0) {
+        close(listener);
+        throw std::runtime_error("Cannot listen on " + socketPath);
+    }
+    while (true) {
+        int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        auto arrival = std::chrono::steady_clock::now();
+        std::string request;
+        std::vector<int> fds;
+        bool stop = false;
+        // a server starting on the same path connects and sends nothing
+        if (receiveRequest(conn, request, fds) && !request.empty()) {
+            std::stringstream ss{request};
+            std::string first;
+            ss >> first;
+            stop = first == "shutdown";
+            sendAll(conn, stop ? "done 0 0\n" : handleRequest(request, fds, runner, arrival));
+        }
+        for (int fd : fds) close(fd);
+        close(conn);
+        if (stop) break;
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+}
+
+bool lab2::submit(const std::string &socketPath, const std::vector<ChainJob> &jobs, std::ostream &out) {
+    std::stringstream request;
+    for (const auto &job : jobs) {
+        for (size_t i = 0; i < job.dims.size(); i++) {
+            request << (i == 0 ? "" : ",") << job.dims[i];
+        }
+        request << ' ' << absolutePath(job.outName);
+        for (const auto &name : job.inNames) request << ' ' << absolutePath(name);
+        request << '\n';
+    }
+    request << '\n';
+    int fd = connectTo(socketPath);
+    if (fd < 0) return false;
+    bool ok = sendAll(fd, request.str());
+    std::string reply;
+    char buffer[4096];
+    while (ok) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        reply.append(buffer, (size_t)n);
+    }
+    close(fd);
+    out << reply;
+    std::stringstream lines{reply};
+    std::string line;
+    bool done = false;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 6, "error ") == 0) ok = false;
+        if (line.compare(0, 5, "done ") == 0) done = true;
+    }
+    return ok && done;
+}
+
+bool lab2::shutdownServer(const std::string &socketPath) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) return false;
+    bool ok = sendAll(fd, "shutdown\n\n");
+    char buffer[64];
+    while (ok && recv(fd, buffer, sizeof(buffer), 0) > 0) {}
+    close(fd);
+    return ok;
+}
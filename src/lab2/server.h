@@ -0,0 +1,38 @@
+#ifndef MTP_LAB1_SERVER_H
+#define MTP_LAB1_SERVER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+#include "batch.h"
+
+
+// Resident mode: a server keeps its threads, memory and tuned parameters between jobs
+// and takes them over a Unix domain socket. A request is a batch (see readBatch) ended
+// by an empty line or by the end of writing. Descriptors of open files, e.g. memfd ones,
+// may be passed along with SCM_RIGHTS, then "fd:<i>" as a file name refers to the i-th
+// of them. The reply has a line for every job:
+//     ok <seconds> <out-name>     or     error <message>
+// where seconds are counted from the arrival of the request, then the last line
+//     done <n-jobs> <seconds>
+namespace lab2 {
+
+// Runs all jobs of a request, results go in the order of jobs
+typedef std::function<std::vector<JobResult>(const std::vector<ChainJob>&)> JobRunner;
+
+// Serves requests one by one until a "shutdown" request comes; requests not received
+// within a few seconds are dropped. Throws std::runtime_error if the socket cannot be
+// set up or another server already listens on it
+void serve(const std::string &socketPath, const JobRunner &runner);
+
+// Sends jobs with their relative file names made absolute and copies the reply to `out`;
+// false if the server cannot be reached or some of the jobs failed
+bool submit(const std::string &socketPath, const std::vector<ChainJob> &jobs, std::ostream &out);
+
+// asks the server to stop, false if it cannot be reached
+bool shutdownServer(const std::string &socketPath);
+
+}
+
+#endif //MTP_LAB1_SERVER_H
@@ -0,0 +1,65 @@
+#include "sparse.h"
+#include "dtypes.h"
+#include "../matfile/MatrixFile.h"
+#include <cmath>
+#include <algorithm>
+
+
+namespace {
+
+template <class T>
+size_t countNonzeros(const T *data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) count += data[i] != 0;
+    return count;
+}
+
+}
+
+
+double lab2::measureDensity(const std::string &filename) {
+    matfile::MappedMatrix matrix{filename};
+    size_t total = matrix.getNRows() * matrix.getNCols(), nonzero = 0;
+    switch (matrix.getDType()) {
+        case matfile::FLOAT32: nonzero = countNonzeros(matrix.as<float>(), total); break;
+        case matfile::FLOAT64: nonzero = countNonzeros(matrix.as<double>(), total); break;
+        case matfile::INT32:   nonzero = countNonzeros(matrix.as<int32_t>(), total); break;
+        case matfile::INT64:   nonzero = countNonzeros(matrix.as<int64_t>(), total); break;
+    }
+    return total == 0 ? 0 : (double)nonzero / total;
+}
+
+double lab2::estimateProductDensity(double density1, double density2, size_t nInner) {
+    // each element of the product is a sum of nInner terms, nonzero with density1*density2 each
+    return 1 - std::pow(1 - std::min(1.0, density1 * density2), (double)nInner);
+}
+
+template <class T>
+lab2::MatrixOp<T>*
+lab2::matmulSparse(mt::TaskGraph &graph, Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2,
+                   size_t nBands, bool sparseResult) {
+    size_t nRows = m1->getNRows(), nCols = m2->getNCols();
+    nBands = std::max<size_t>(1, std::min(nBands, nRows));
+    if (nBands == 1) {
+        auto product = new SparseMultiplication<T>(nRows, nCols, 0, sparseResult);
+        product = graph.addShared(product, {m1, m2});
+        return product;
+    }
+    std::vector<mt::Task*> bands;
+    for (size_t i = 0; i < nBands; i++) {
+        size_t rowBegin = nRows*i / nBands, rowEnd = nRows*(i + 1) / nBands;
+        auto band = new SparseMultiplication<T>(rowEnd - rowBegin, nCols, rowBegin, sparseResult);
+        band = graph.addShared(band, {m1, m2});
+        bands.push_back(band);
+    }
+    auto product = new RowBands<T>(nRows, nCols, nBands);
+    product = graph.addShared(product, bands);
+    return product;
+}
+
+
+#define INSTANTIATE_SPARSE(T) \
+    template lab2::MatrixOp<T>* lab2::matmulSparse<T>( \
+            mt::TaskGraph&, lab2::Lab2BaseTask<T>*, lab2::Lab2BaseTask<T>*, size_t, bool);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_SPARSE)
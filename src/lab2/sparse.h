@@ -0,0 +1,27 @@
+#ifndef MTP_LAB1_SPARSE_H
+#define MTP_LAB1_SPARSE_H
+
+#include <string>
+#include "../mt/TaskGraph.h"
+#include "tasks.h"
+
+
+namespace lab2 {
+
+// Fraction of nonzero elements in a binary matrix file, throws std::runtime_error
+// if it cannot be read
+double measureDensity(const std::string &filename);
+
+// Expected density of the product of nRows x nInner and nInner x nCols matrices
+// with nonzeros scattered uniformly at given densities
+double estimateProductDensity(double density1, double density2, size_t nInner);
+
+// Product of matrices of which at least one is sparse, split into nBands bands of rows
+// computed by SparseMultiplication tasks in parallel; see SparseMultiplication for sparseResult
+template <class T>
+MatrixOp<T>* matmulSparse(mt::TaskGraph &graph, Lab2BaseTask<T>* m1, Lab2BaseTask<T>* m2,
+                          size_t nBands, bool sparseResult);
+
+}
+
+#endif //MTP_LAB1_SPARSE_H
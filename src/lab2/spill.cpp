@@ -0,0 +1,102 @@
+#include "spill.h"
+#include <unistd.h>
+
+
+namespace {
+
+lab2::SpillManager *currentManager = nullptr;
+
+}
+
+
+lab2::SpillManager::SpillManager(const std::string &scratchDir, size_t memoryLimit)
+        : _scratchDir(scratchDir), _memoryLimit(memoryLimit) {}
+
+lab2::SpillManager* lab2::SpillManager::getCurrent() {
+    return currentManager;
+}
+
+void lab2::SpillManager::setCurrent(SpillManager *manager) {
+    currentManager = manager;
+}
+
+void lab2::SpillManager::reserve(Spillable *owner, size_t bytes) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    State &state = _states[owner];
+    state.lastUse = ++_clock;
+    state.bytes = bytes;
+    while (getResidentMemory() > _memoryLimit && spillLeastRecentlyUsed(owner)) {}
+}
+
+bool lab2::SpillManager::spillIdle(Spillable *owner) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    return spillLeastRecentlyUsed(owner);
+}
+
+void lab2::SpillManager::add(Spillable *s) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    State &state = _states[s];
+    state.lastUse = ++_clock;
+    state.bytes = s->getResidentMemory();
+}
+
+void lab2::SpillManager::remove(Spillable *s) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    _states.erase(s);
+}
+
+void lab2::SpillManager::pin(Spillable *s) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    // registered here if it was not yet, so that a later add() keeps the pin
+    State &state = _states[s];
+    state.nPins++;
+    state.lastUse = ++_clock;
+    s->prefetch();
+}
+
+void lab2::SpillManager::unpin(Spillable *s) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    auto it = _states.find(s);
+    if (it == _states.end() || it->second.nPins == 0) return;
+    it->second.nPins--;
+    it->second.lastUse = ++_clock;
+}
+
+size_t lab2::SpillManager::getSpilledMemory() const {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    return _spilledMemory;
+}
+
+size_t lab2::SpillManager::getResidentMemory() const {
+    size_t total = 0;
+    for (const auto &s : _states) total += s.second.bytes;
+    return total;
+}
+
+bool lab2::SpillManager::spillLeastRecentlyUsed(Spillable *owner) {
+    Spillable *victim = nullptr;
+    unsigned long victimUse = 0;
+    for (auto &s : _states) {
+        if (s.first == owner || s.second.unspillable || s.second.nPins > 0 || !s.first->isIdle()) continue;
+        // idle storage does not change, except for being borrowed by a consumer
+        s.second.bytes = s.first->getResidentMemory();
+        if (s.second.bytes == 0) continue;
+        if (victim == nullptr || s.second.lastUse < victimUse) {
+            victim = s.first;
+            victimUse = s.second.lastUse;
+        }
+    }
+    if (victim == nullptr) return false;
+    size_t bytes = _states[victim].bytes;
+    std::string path = _scratchDir + "/lab2-" + std::to_string(getpid())
+                       + "-spill" + std::to_string(++_nSpills);
+    if (!victim->spill(path)) {
+        // it stays in memory, but is not tried again
+        _states[victim].unspillable = true;
+        _states[victim].bytes = victim->getResidentMemory();
+        return true;
+    }
+    _states[victim].bytes = 0;
+    _spilledMemory += bytes;
+    return true;
+}
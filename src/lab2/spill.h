@@ -0,0 +1,108 @@
+#ifndef MTP_LAB1_SPILL_H
+#define MTP_LAB1_SPILL_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+
+namespace lab2 {
+
+// Storage which SpillManager may move to disk while nobody uses it
+class Spillable {
+
+public:
+
+    virtual ~Spillable() {}
+
+    // memory which spill() would release
+    virtual size_t getResidentMemory() const = 0;
+    // true when the storage is not going to be written any more
+    virtual bool isIdle() const = 0;
+    // moves the contents to a new scratch file at `path`, false if it cannot be done
+    virtual bool spill(const std::string &path) = 0;
+    // asks the kernel to start reading spilled contents back into memory
+    virtual void prefetch() = 0;
+
+};
+
+
+// Keeps memory of spillables within a limit. When new memory is reserved beyond it,
+// idle spillables which were not used for the longest time are written to scratch
+// files and mapped back from there, so that their pages are read again only when
+// touched. Pinned spillables are in use and stay where they are.
+class SpillManager {
+
+public:
+
+    SpillManager(const std::string &scratchDir, size_t memoryLimit);
+
+    // manager used by lab2 tasks, nullptr (default) if spilling is off
+    static SpillManager* getCurrent();
+    static void setCurrent(SpillManager *manager);
+
+    // Registers `owner`, which is about to hold `bytes` of memory, and spills other
+    // spillables until the total fits in the limit, as far as possible
+    void reserve(Spillable *owner, size_t bytes);
+    // spills one more idle spillable other than `owner`, false if there are none
+    bool spillIdle(Spillable *owner);
+
+    // registers `s` or updates its memory; called by the thread which writes it
+    void add(Spillable *s);
+    void remove(Spillable *s);
+
+    // Pinned spillables are never spilled; pinning a spilled one prefetches it
+    void pin(Spillable *s);
+    void unpin(Spillable *s);
+
+    // total size of spilled contents
+    size_t getSpilledMemory() const;
+
+    // pins given spillables while it lives
+    class Pin {
+    public:
+        template <class S>
+        Pin(SpillManager *manager, const std::vector<S*> &spillables)
+                : _manager(manager), _spillables(spillables.begin(), spillables.end()) {
+            if (_manager != nullptr) for (auto s : _spillables) _manager->pin(s);
+        }
+        ~Pin() {
+            if (_manager != nullptr) for (auto s : _spillables) _manager->unpin(s);
+        }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+    private:
+        SpillManager *_manager;
+        std::vector<Spillable*> _spillables;
+    };
+
+private:
+
+    struct State {
+        unsigned nPins = 0;
+        unsigned long lastUse = 0;
+        // resident memory as last seen
+        size_t bytes = 0;
+        // set when spill() failed, it is not tried again
+        bool unspillable = false;
+    };
+
+    const std::string _scratchDir;
+    const size_t _memoryLimit;
+    std::map<Spillable*, State> _states;
+    unsigned long _clock = 0;
+    unsigned long _nSpills = 0;
+    size_t _spilledMemory = 0;
+    mutable std::mutex _mtx;
+
+    size_t getResidentMemory() const;
+    // the same as spillIdle(), with _mtx locked
+    bool spillLeastRecentlyUsed(Spillable *owner);
+
+};
+
+}
+
+#endif //MTP_LAB1_SPILL_H
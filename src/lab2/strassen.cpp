@@ -1,77 +1,308 @@
 
 #include "strassen.h"
+#include "dtypes.h"
+#include <algorithm>
+#include <functional>
 
 
-lab2::MatrixOp*
-defineSum(mt::TaskGraph &graph, lab2::Lab2BaseTask *m1, lab2::Lab2BaseTask *m2, float coeff=1, bool borrow=false) {
-    auto sum = new lab2::Addition(m1->getNRows(), m2->getNCols(), coeff, borrow);
-    graph.addTask(sum, {m1, m2});
+template <class T>
+lab2::MatrixOp<T>*
+defineSum(mt::TaskGraph &graph, lab2::Lab2BaseTask<T> *m1, lab2::Lab2BaseTask<T> *m2, T coeff=1, bool borrow=false) {
+    auto sum = new lab2::Addition<T>(m1->getNRows(), m2->getNCols(), coeff, borrow);
+    sum = graph.addShared(sum, {m1, m2});
     return sum;
 }
 
 
-lab2::MatrixOp*
-lab2::matmulStrassen(mt::TaskGraph &graph, Lab2BaseTask *m1, Lab2BaseTask *m2, size_t limit) {
-    size_t matSz = m1->getNCols();
-    if (matSz <= limit) {
-        auto mul = new Multiplication(m1->getNRows(), m2->getNCols());
-        graph.addTask(mul, {m1, m2});
+// Defines sum of coeffs[i]*terms[i] as a single LinearCombination task,
+// a lone term with unit coefficient is used as is
+template <class T>
+lab2::Lab2BaseTask<T>*
+defineCombination(mt::TaskGraph &graph,
+                  const std::vector<lab2::Lab2BaseTask<T>*> &terms,
+                  const std::vector<T> &coeffs) {
+    std::vector<mt::Task*> nonzeroTerms;
+    std::vector<T> nonzeroCoeffs;
+    for (size_t i = 0; i < terms.size(); i++) {
+        if (coeffs[i] == 0) continue;
+        nonzeroTerms.push_back(terms[i]);
+        nonzeroCoeffs.push_back(coeffs[i]);
+    }
+    if (nonzeroTerms.empty()) {
+        throw std::runtime_error("Empty linear combination in multiplication scheme");
+    }
+    if (nonzeroTerms.size() == 1 && nonzeroCoeffs[0] == 1) {
+        return dynamic_cast<lab2::Lab2BaseTask<T>*>(nonzeroTerms[0]);
+    }
+    auto combination = new lab2::LinearCombination<T>(terms[0]->getNRows(), terms[0]->getNCols(),
+                                                      nonzeroCoeffs);
+    combination = graph.addShared(combination, nonzeroTerms);
+    return combination;
+}
+
+
+// Dynamic peeling: the leading block of each operand with dimensions divisible by
+// (rowsDivisor, innerDivisor, colsDivisor) is multiplied by `core`, and the remaining
+// thin rows and columns are handled with plain multiplications and fixed up afterwards.
+template <class T>
+lab2::MatrixOp<T>*
+definePeeled(mt::TaskGraph &graph, lab2::Lab2BaseTask<T> *m1, lab2::Lab2BaseTask<T> *m2,
+             size_t rowsDivisor, size_t innerDivisor, size_t colsDivisor,
+             const std::function<lab2::MatrixOp<T>*(lab2::Lab2BaseTask<T>*, lab2::Lab2BaseTask<T>*)> &core) {
+    using namespace lab2;
+    size_t nRows = m1->getNRows(), nInner = m1->getNCols(), nCols = m2->getNCols();
+    size_t coreRows = nRows - nRows % rowsDivisor;
+    size_t coreInner = nInner - nInner % innerDivisor;
+    size_t coreCols = nCols - nCols % colsDivisor;
+    if (coreRows == nRows && coreInner == nInner && coreCols == nCols) {
+        return core(m1, m2);
+    }
+
+    auto subscript = [&graph] (Lab2BaseTask<T> *m, size_t rowOffs, size_t colOffs,
+                               size_t nRows, size_t nCols) -> Lab2BaseTask<T>* {
+        if (rowOffs == 0 && colOffs == 0 && nRows == m->getNRows() && nCols == m->getNCols())
+            return m;
+        auto sub = new Subscripting<T>(nRows, nCols, rowOffs, colOffs);
+        sub = graph.addShared(sub, {m});
+        return sub;
+    };
+    auto multiply = [&graph] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) -> MatrixOp<T>* {
+        auto mul = new Multiplication<T>(m1->getNRows(), m2->getNCols());
+        mul = graph.addShared(mul, {m1, m2});
         return mul;
+    };
+
+    MatrixOp<T> *result = core(subscript(m1, 0, 0, coreRows, coreInner),
+                            subscript(m2, 0, 0, coreInner, coreCols));
+    if (coreInner < nInner) {
+        auto update = multiply(subscript(m1, 0, coreInner, coreRows, nInner - coreInner),
+                               subscript(m2, coreInner, 0, nInner - coreInner, coreCols));
+        result = defineSum<T>(graph, result, update);
     }
-    size_t subSz = matSz / 2;
-    auto A11 = new Subscripting(subSz, subSz, 0,     0);
-    auto A12 = new Subscripting(subSz, subSz, 0,     subSz);
-    auto A21 = new Subscripting(subSz, subSz, subSz, 0);
-    auto A22 = new Subscripting(subSz, subSz, subSz, subSz);
-    graph.addTask(A11, {m1});
-    graph.addTask(A12, {m1});
-    graph.addTask(A21, {m1});
-    graph.addTask(A22, {m1});
-
-    auto B11 = new Subscripting(subSz, subSz, 0,     0);
-    auto B12 = new Subscripting(subSz, subSz, 0,     subSz);
-    auto B21 = new Subscripting(subSz, subSz, subSz, 0);
-    auto B22 = new Subscripting(subSz, subSz, subSz, subSz);
-    graph.addTask(B11, {m2});
-    graph.addTask(B12, {m2});
-    graph.addTask(B21, {m2});
-    graph.addTask(B22, {m2});
-
-    auto P1 = matmulStrassen(graph,
-                             defineSum(graph, A11, A22),
-                             defineSum(graph, B11, B22),
-                             limit);
-    auto P2 = matmulStrassen(graph,
-                             defineSum(graph, A21, A22),
-                             B11,
-                             limit);
-    auto P3 = matmulStrassen(graph,
-                             A11,
-                             defineSum(graph, B12, B22, -1),
-                             limit);
-    auto P4 = matmulStrassen(graph,
-                             A22,
-                             defineSum(graph, B21, B11, -1),
-                             limit);
-    auto P5 = matmulStrassen(graph,
-                             defineSum(graph, A11, A12),
-                             B22,
-                             limit);
-    auto P6 = matmulStrassen(graph,
-                             defineSum(graph, A21, A11, -1),
-                             defineSum(graph, B11, B12),
-                             limit);
-    auto P7 = matmulStrassen(graph,
-                             defineSum(graph, A12, A22, -1),
-                             defineSum(graph, B21, B22),
-                             limit);
-
-    auto C11 = defineSum(graph, defineSum(graph, P1, P4), defineSum(graph, P7, P5, -1));
-    auto C12 = defineSum(graph, P3, P5);
-    auto C21 = defineSum(graph, P2, P4);
-    auto C22 = defineSum(graph, defineSum(graph, P1, P2, -1), defineSum(graph, P3, P6));
-
-    auto C = new BlockMatrix(matSz, matSz);
-    graph.addTask(C, {C11, C12, C21, C22});
-    return C;
+    if (coreCols < nCols) {
+        auto lastCols = multiply(subscript(m1, 0, 0, coreRows, nInner),
+                                 subscript(m2, 0, coreCols, nInner, nCols - coreCols));
+        auto joined = new BlockMatrix<T>(coreRows, nCols, 1, 2);
+        joined = graph.addShared(joined, {result, lastCols});
+        result = joined;
+    }
+    if (coreRows < nRows) {
+        auto lastRows = multiply(subscript(m1, coreRows, 0, nRows - coreRows, nInner), m2);
+        auto joined = new BlockMatrix<T>(nRows, nCols, 2, 1);
+        joined = graph.addShared(joined, {result, lastRows});
+        result = joined;
+    }
+    return result;
 }
+
+
+template <class T>
+lab2::MatrixOp<T>*
+lab2::matmulStrassen(mt::TaskGraph &graph, Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2, size_t limit) {
+    size_t nRows = m1->getNRows(), nInner = m1->getNCols(), nCols = m2->getNCols();
+    if (std::min(nRows, std::min(nInner, nCols)) <= limit) {
+        auto mul = new Multiplication<T>(nRows, nCols);
+        mul = graph.addShared(mul, {m1, m2});
+        return mul;
+    }
+    return definePeeled<T>(graph, m1, m2, 2, 2, 2, [&graph, limit] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+        size_t nRows = m1->getNRows(), nCols = m2->getNCols();
+        size_t m = nRows / 2, k = m1->getNCols() / 2, n = nCols / 2;
+        auto A11 = new Subscripting<T>(m, k, 0, 0);
+        auto A12 = new Subscripting<T>(m, k, 0, k);
+        auto A21 = new Subscripting<T>(m, k, m, 0);
+        auto A22 = new Subscripting<T>(m, k, m, k);
+        A11 = graph.addShared(A11, {m1});
+        A12 = graph.addShared(A12, {m1});
+        A21 = graph.addShared(A21, {m1});
+        A22 = graph.addShared(A22, {m1});
+
+        auto B11 = new Subscripting<T>(k, n, 0, 0);
+        auto B12 = new Subscripting<T>(k, n, 0, n);
+        auto B21 = new Subscripting<T>(k, n, k, 0);
+        auto B22 = new Subscripting<T>(k, n, k, n);
+        B11 = graph.addShared(B11, {m2});
+        B12 = graph.addShared(B12, {m2});
+        B21 = graph.addShared(B21, {m2});
+        B22 = graph.addShared(B22, {m2});
+
+        auto P1 = matmulStrassen<T>(graph,
+                                    defineCombination<T>(graph, {A11, A22}, {1, 1}),
+                                    defineCombination<T>(graph, {B11, B22}, {1, 1}),
+                                    limit);
+        auto P2 = matmulStrassen<T>(graph,
+                                    defineCombination<T>(graph, {A21, A22}, {1, 1}),
+                                    B11,
+                                    limit);
+        auto P3 = matmulStrassen<T>(graph,
+                                    A11,
+                                    defineCombination<T>(graph, {B12, B22}, {1, -1}),
+                                    limit);
+        auto P4 = matmulStrassen<T>(graph,
+                                    A22,
+                                    defineCombination<T>(graph, {B21, B11}, {1, -1}),
+                                    limit);
+        auto P5 = matmulStrassen<T>(graph,
+                                    defineCombination<T>(graph, {A11, A12}, {1, 1}),
+                                    B22,
+                                    limit);
+        auto P6 = matmulStrassen<T>(graph,
+                                    defineCombination<T>(graph, {A21, A11}, {1, -1}),
+                                    defineCombination<T>(graph, {B11, B12}, {1, 1}),
+                                    limit);
+        auto P7 = matmulStrassen<T>(graph,
+                                    defineCombination<T>(graph, {A12, A22}, {1, -1}),
+                                    defineCombination<T>(graph, {B21, B22}, {1, 1}),
+                                    limit);
+
+        // each block of the result is computed in one pass over the products
+        auto C11 = defineCombination<T>(graph, {P1, P4, P7, P5}, {1, 1, 1, -1});
+        auto C12 = defineCombination<T>(graph, {P3, P5}, {1, 1});
+        auto C21 = defineCombination<T>(graph, {P2, P4}, {1, 1});
+        auto C22 = defineCombination<T>(graph, {P1, P2, P3, P6}, {1, -1, 1, 1});
+
+        auto C = new BlockMatrix<T>(nRows, nCols);
+        C = graph.addShared(C, {C11, C12, C21, C22});
+        return C;
+    });
+}
+
+
+template <class T>
+lab2::MatrixOp<T>*
+lab2::matmulWinograd(mt::TaskGraph &graph, Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2,
+                     size_t limit, unsigned graphLevels, bool morton) {
+    size_t nRows = m1->getNRows(), nInner = m1->getNCols(), nCols = m2->getNCols();
+    if (graphLevels == 0 || std::min(nRows, std::min(nInner, nCols)) <= limit) {
+        auto mul = new WinogradMultiplication<T>(nRows, nCols, limit, morton);
+        mul = graph.addShared(mul, {m1, m2});
+        return mul;
+    }
+    auto core = [&graph, limit, graphLevels, morton] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) {
+        size_t nRows = m1->getNRows(), nCols = m2->getNCols();
+        size_t m = nRows / 2, k = m1->getNCols() / 2, n = nCols / 2;
+        auto A11 = new Subscripting<T>(m, k, 0, 0);
+        auto A12 = new Subscripting<T>(m, k, 0, k);
+        auto A21 = new Subscripting<T>(m, k, m, 0);
+        auto A22 = new Subscripting<T>(m, k, m, k);
+        A11 = graph.addShared(A11, {m1});
+        A12 = graph.addShared(A12, {m1});
+        A21 = graph.addShared(A21, {m1});
+        A22 = graph.addShared(A22, {m1});
+
+        auto B11 = new Subscripting<T>(k, n, 0, 0);
+        auto B12 = new Subscripting<T>(k, n, 0, n);
+        auto B21 = new Subscripting<T>(k, n, k, 0);
+        auto B22 = new Subscripting<T>(k, n, k, n);
+        B11 = graph.addShared(B11, {m2});
+        B12 = graph.addShared(B12, {m2});
+        B21 = graph.addShared(B21, {m2});
+        B22 = graph.addShared(B22, {m2});
+
+        auto S1 = defineSum<T>(graph, A21, A22);
+        auto S2 = defineSum<T>(graph, S1, A11, -1);
+        auto S3 = defineSum<T>(graph, A11, A21, -1);
+        auto S4 = defineSum<T>(graph, A12, S2, -1);
+        auto T1 = defineSum<T>(graph, B12, B11, -1);
+        auto T2 = defineSum<T>(graph, B22, T1, -1);
+        auto T3 = defineSum<T>(graph, B22, B12, -1);
+        auto T4 = defineSum<T>(graph, T2, B21, -1);
+
+        unsigned levels = graphLevels - 1;
+        auto P1 = matmulWinograd<T>(graph, A11, B11, limit, levels, morton);
+        auto P2 = matmulWinograd<T>(graph, A12, B21, limit, levels, morton);
+        auto P3 = matmulWinograd<T>(graph, S4,  B22, limit, levels, morton);
+        auto P4 = matmulWinograd<T>(graph, A22, T4,  limit, levels, morton);
+        auto P5 = matmulWinograd<T>(graph, S1,  T1,  limit, levels, morton);
+        auto P6 = matmulWinograd<T>(graph, S2,  T2,  limit, levels, morton);
+        auto P7 = matmulWinograd<T>(graph, S3,  T3,  limit, levels, morton);
+
+        auto U2 = defineSum<T>(graph, P1, P6);
+        auto U3 = defineSum<T>(graph, U2, P7);
+        auto C11 = defineSum<T>(graph, P1, P2);
+        auto C12 = defineSum<T>(graph, defineSum<T>(graph, U2, P5), P3);
+        auto C21 = defineSum<T>(graph, U3, P4, -1);
+        auto C22 = defineSum<T>(graph, U3, P5);
+
+        auto C = new BlockMatrix<T>(nRows, nCols);
+        C = graph.addShared(C, {C11, C12, C21, C22});
+        return C;
+    };
+    return definePeeled<T>(graph, m1, m2, 2, 2, 2, core);
+}
+
+
+template <class T>
+lab2::MatrixOp<T>*
+defineSchemeLevel(mt::TaskGraph &graph, lab2::Lab2BaseTask<T> *m1, lab2::Lab2BaseTask<T> *m2,
+                  const lab2::SchemeList &schemes, size_t limit,
+                  unsigned graphLevels, size_t level) {
+    using namespace lab2;
+    const auto &scheme = schemeAt(schemes, level);
+    size_t nRows = m1->getNRows(), nInner = m1->getNCols(), nCols = m2->getNCols();
+    if (graphLevels == 0 || isSchemeLeaf(scheme, nRows, nInner, nCols, limit)) {
+        auto mul = new SchemeMultiplication<T>(nRows, nCols, schemes, level, limit);
+        mul = graph.addShared(mul, {m1, m2});
+        return mul;
+    }
+    auto core = [&] (Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2) -> MatrixOp<T>* {
+        size_t nRows = m1->getNRows(), nCols = m2->getNCols();
+        size_t m = nRows / scheme.m, k = m1->getNCols() / scheme.k, n = nCols / scheme.n;
+
+        std::vector<Lab2BaseTask<T>*> A, B;
+        for (size_t i = 0; i < scheme.m; i++) {
+            for (size_t j = 0; j < scheme.k; j++) {
+                auto block = new Subscripting<T>(m, k, i*m, j*k);
+                block = graph.addShared(block, {m1});
+                A.push_back(block);
+            }
+        }
+        for (size_t i = 0; i < scheme.k; i++) {
+            for (size_t j = 0; j < scheme.n; j++) {
+                auto block = new Subscripting<T>(k, n, i*k, j*n);
+                block = graph.addShared(block, {m2});
+                B.push_back(block);
+            }
+        }
+
+        auto coefficients = [] (const std::vector<float> &row) {
+            return std::vector<T>(row.begin(), row.end());
+        };
+        std::vector<Lab2BaseTask<T>*> P;
+        for (size_t r = 0; r < scheme.rank; r++) {
+            auto left = defineCombination<T>(graph, A, coefficients(scheme.U[r]));
+            auto right = defineCombination<T>(graph, B, coefficients(scheme.V[r]));
+            P.push_back(defineSchemeLevel<T>(graph, left, right, schemes, limit, graphLevels - 1, level + 1));
+        }
+
+        std::vector<mt::Task*> C;
+        for (size_t c = 0; c < scheme.m * scheme.n; c++) {
+            C.push_back(defineCombination<T>(graph, P, coefficients(scheme.W[c])));
+        }
+
+        auto result = new BlockMatrix<T>(nRows, nCols, scheme.m, scheme.n);
+        result = graph.addShared(result, C);
+        return result;
+    };
+    return definePeeled<T>(graph, m1, m2, scheme.m, scheme.k, scheme.n, core);
+}
+
+
+template <class T>
+lab2::MatrixOp<T>*
+lab2::matmulScheme(mt::TaskGraph &graph, Lab2BaseTask<T> *m1, Lab2BaseTask<T> *m2,
+                   const SchemeList &schemes, size_t limit, unsigned graphLevels) {
+    return defineSchemeLevel<T>(graph, m1, m2, schemes, limit, graphLevels, 0);
+}
+
+
+#define INSTANTIATE_STRASSEN(T) \
+    template lab2::MatrixOp<T>* lab2::matmulStrassen<T>( \
+            mt::TaskGraph&, lab2::Lab2BaseTask<T>*, lab2::Lab2BaseTask<T>*, size_t); \
+    template lab2::MatrixOp<T>* lab2::matmulWinograd<T>( \
+            mt::TaskGraph&, lab2::Lab2BaseTask<T>*, lab2::Lab2BaseTask<T>*, size_t, unsigned, bool); \
+    template lab2::MatrixOp<T>* lab2::matmulScheme<T>( \
+            mt::TaskGraph&, lab2::Lab2BaseTask<T>*, lab2::Lab2BaseTask<T>*, \
+            const lab2::SchemeList&, size_t, unsigned);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_STRASSEN)
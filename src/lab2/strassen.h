@@ -3,11 +3,28 @@
 
 #include "../mt/TaskGraph.h"
 #include "tasks.h"
+#include "schemes.h"
 
 
 namespace lab2 {
 
-MatrixOp* matmulStrassen(mt::TaskGraph &graph, Lab2BaseTask* m1, Lab2BaseTask* m2, size_t limit);
+template <class T>
+MatrixOp<T>* matmulStrassen(mt::TaskGraph &graph, Lab2BaseTask<T>* m1, Lab2BaseTask<T>* m2, size_t limit);
+
+// Strassen-Winograd variant: only top `graphLevels` levels of recursion are
+// expanded into graph tasks, deeper levels are computed by WinogradMultiplication
+// tasks sequentially, each over its own preallocated workspace; with `morton`
+// those tasks run over operands converted to Morton layout
+template <class T>
+MatrixOp<T>* matmulWinograd(mt::TaskGraph &graph, Lab2BaseTask<T>* m1, Lab2BaseTask<T>* m2,
+                            size_t limit, unsigned graphLevels, bool morton = false);
+
+// Generic fast multiplication driven by bilinear schemes, one per recursion level
+// (the last one repeats). Top `graphLevels` levels are expanded into graph tasks,
+// deeper levels are computed by SchemeMultiplication tasks over a workspace.
+template <class T>
+MatrixOp<T>* matmulScheme(mt::TaskGraph &graph, Lab2BaseTask<T>* m1, Lab2BaseTask<T>* m2,
+                          const SchemeList &schemes, size_t limit, unsigned graphLevels);
 
 }
 
@@ -2,20 +2,35 @@
 #define MTP_LAB1_TASKS_H
 
 #include <string>
-#include <fstream>
+#include <iostream>
 #include <sstream>
 #include <cassert>
+#include <memory>
+#include <chrono>
+#include <limits>
+#include <iomanip>
 
 #include "../mt/Task.h"
 #include "MatrixBuffer.h"
+#include "MatrixExpr.h"
+#include "SparseMatrix.h"
+#include "spill.h"
+#include "winograd.h"
+#include "morton.h"
+#include "schemes.h"
+#include "../matfile/MatrixFile.h"
+#include "../matfile/TextMatrix.h"
+#include "../matfile/MatrixFileWriter.h"
+#include "../matfile/ResultCache.h"
 
 
 namespace lab2 {
 
-class Lab2BaseTask : public mt::Task {
-    friend class MatrixReader;
-    friend class MatrixOp;
-    friend class MatrixWriter;
+template <class T>
+class Lab2BaseTask : public mt::Task, public Spillable {
+    template <class> friend class MatrixReader;
+    template <class> friend class MatrixOp;
+    template <class> friend class MatrixWriter;
 
 public:
 
@@ -35,8 +50,65 @@ public:
     size_t getNRows() { return _result.getNRows(); }
     size_t getNCols() { return _result.getNCols(); }
 
+    // the result, and its packed copy when multiplications share it (see getPacked())
+    size_t getMemoryUsage() const override {
+        return getResultMemory() * (_nPackUsers > 1 ? 2 : 1);
+    }
+
+    // Finished results may be spilled by SpillManager::getCurrent() while no consumer pins them
+    size_t getResidentMemory() const override {
+        size_t bytes = _result.isAllocated() && !_result.isExternal() ? getResultMemory() : 0;
+        std::unique_lock<std::mutex> _lk{_packMtx};
+        return bytes + _packed.capacity() * sizeof(T);
+    }
+    bool isIdle() const override { return isDone(); }
+    // the packed copy is dropped, getPacked() builds it again if needed
+    bool spill(const std::string &path) override {
+        {
+            std::unique_lock<std::mutex> _lk{_packMtx};
+            freePacked();
+        }
+        return _result.spill(path);
+    }
+    void prefetch() override { _result.prefetch(); }
+
+    // Result packed for use as a right-hand operand of multiplications. It is built
+    // by the first multiplication asking for it and shared with the rest of them, so
+    // it is nullptr for results used by a single multiplication, and when it cannot
+    // be allocated. Each multiplication which got it calls releasePacked() when done
+    // with it; the last one frees it.
+    const std::vector<T>* getPacked() {
+        {
+            std::unique_lock<std::mutex> _lk{_packMtx};
+            if (_nPackUsers < 2) return nullptr;
+            if (_isPacked) return &_packed;
+            _isPacked = _result.pack(_packed);
+            if (!_isPacked) return nullptr;
+        }
+        // not under _packMtx, the manager asks for resident memory
+        updateSpillManager();
+        return &_packed;
+    }
+    void releasePacked() {
+        {
+            std::unique_lock<std::mutex> _lk{_packMtx};
+            if (++_nPackReleases < _nPackUsers) return;
+            freePacked();
+        }
+        updateSpillManager();
+    }
+    // counts multiplications taking the result as their right-hand operand
+    void addPackUser() {
+        std::unique_lock<std::mutex> _lk{_packMtx};
+        _nPackUsers++;
+    }
+
+    // Result in sparse form, nullptr if it has only the dense one
+    const SparseMatrix<T>* getSparse() const { return _sparse.get(); }
+
 protected:
-    MatrixBuffer _result;
+    MatrixBuffer<T> _result;
+    std::unique_ptr<SparseMatrix<T>> _sparse;
 
     void fail(const std::string &cause) {
         std::unique_lock<std::mutex> _lk{_failMtx};
@@ -44,8 +116,32 @@ protected:
         _failCause = cause;
     }
 
+    size_t getResultMemory() const { return _result.getTotalSize() * sizeof(T); }
+
+    // signature of a task doing op with given parameters, see mt::Task::getSignature()
+    std::string signature(const std::string &op, const std::string &params = "") const {
+        std::stringstream ss;
+        ss << op << ' ' << _result.getNRows() << 'x' << _result.getNCols() << ' ' << params;
+        return ss.str();
+    }
+
+    // coefficients written exactly, for signatures
+    static std::string formatCoeffs(const std::vector<T> &coeffs) {
+        std::stringstream ss;
+        ss << std::setprecision(std::numeric_limits<T>::max_digits10);
+        for (T c : coeffs) ss << c << ' ';
+        return ss.str();
+    }
+
     bool allocateBuffer() {
-        if (!_result.allocate()) {
+        SpillManager *spillManager = SpillManager::getCurrent();
+        if (spillManager != nullptr) spillManager->reserve(this, getResultMemory());
+        bool allocated = _result.allocate();
+        // out of memory, idle results go to disk one by one until it fits
+        while (!allocated && spillManager != nullptr && spillManager->spillIdle(this)) {
+            allocated = _result.allocate();
+        }
+        if (!allocated) {
             std::stringstream ss;
             ss << "Cannot allocate buffer of size "
                << _result.getNRows() << 'x' << _result.getNCols()
@@ -56,8 +152,24 @@ protected:
         return true;
     }
 
-    void doFinalize() {
+    // Builds the dense form of a sparse result for consumers which need it, false on errors
+    bool densify() {
+        std::unique_lock<std::mutex> _lk{_densifyMtx};
+        if (_result.isAllocated() || _sparse == nullptr) return true;
+        if (!allocateBuffer()) return false;
+        _sparse->copyTo(_result);
+        _result.shrinkNonzeroBox();
+        return true;
+    }
+
+    void doFinalize() override {
+        SpillManager *spillManager = SpillManager::getCurrent();
+        if (spillManager != nullptr) spillManager->remove(this);
         if (_result.isAllocated()) _result.free();
+        _sparse.reset();
+        std::unique_lock<std::mutex> _lk{_packMtx};
+        freePacked();
+        _nPackReleases = 0;
     }
 
 private:
@@ -65,88 +177,187 @@ private:
     mutable std::mutex _failMtx;
     std::string _failCause;
 
+    bool _isPacked = false;
+    std::vector<T> _packed;
+    unsigned _nPackUsers = 0, _nPackReleases = 0;
+    mutable std::mutex _packMtx;
+
+    // with _packMtx locked
+    void freePacked() {
+        _packed.clear();
+        _packed.shrink_to_fit();
+        _isPacked = false;
+    }
+
+    void updateSpillManager() {
+        SpillManager *spillManager = SpillManager::getCurrent();
+        if (spillManager != nullptr) spillManager->add(this);
+    }
+
+    std::mutex _densifyMtx;
+
 };
 
 
-class MatrixReader : public Lab2BaseTask {
+template <class T>
+class MatrixReader : public Lab2BaseTask<T> {
 
     const std::string _filename;
-    const size_t _nominalNRows, _nominalNCols;
+    const unsigned _nParseThreads;
+    const double _sparseDensity;
 
 public:
 
-    MatrixReader(const std::string &filename,
-                 size_t nominalNRows, size_t nominalNCols,
-                 size_t realNRows, size_t realNCols)
-            : Lab2BaseTask(realNRows, realNCols)
-            , _nominalNRows(nominalNRows)
-            , _nominalNCols(nominalNCols)
-            , _filename(filename) {}
+    // Text files are parsed on up to nParseThreads threads. Matrices with at most
+    // sparseDensity of nonzero elements are kept in sparse form only.
+    MatrixReader(const std::string &filename, size_t nRows, size_t nCols, unsigned nParseThreads = 1,
+                 double sparseDensity = 0)
+            : Lab2BaseTask<T>(nRows, nCols)
+            , _filename(filename)
+            , _nParseThreads(nParseThreads)
+            , _sparseDensity(sparseDensity) {}
 
     bool doWorkPortion() override {
-        if (!allocateBuffer())
+        if (matfile::isMatrixFile(_filename)) {
+            readBinary();
+            if (!this->hasFailed()) makeSparse();
+            return true;
+        }
+        if (!this->allocateBuffer())
             return true;
 
-        std::ifstream file{_filename};
-        for (size_t r = 0; r < _nominalNRows; r++) {
-            for (size_t c = 0; c < _nominalNCols; c++) {
-                file >> _result.at(r, c);
-            }
+        try {
+            matfile::TextMatrixReader reader{_filename};
+            reader.readAll(&this->_result.at(0, 0), this->_result.getTotalSize(), _nParseThreads);
+        } catch (const std::runtime_error &err) {
+            this->fail(err.what());
+            return true;
         }
+        // zero blocks found here are skipped by all the arithmetic downstream
+        this->_result.shrinkNonzeroBox();
+        makeSparse();
         return true;
     }
 
     bool isWaiting() override { return false; };
 
+    std::string getSignature() const override {
+        return this->signature("read", std::to_string(_sparseDensity) + ' ' + _filename);
+    }
+
+private:
+
+    // Binary files are used in place when their element type is T, otherwise converted
+    void readBinary() {
+        std::shared_ptr<matfile::MappedMatrix> matrix;
+        try {
+            matrix = std::make_shared<matfile::MappedMatrix>(_filename);
+        } catch (const std::runtime_error &err) {
+            this->fail(err.what());
+            return;
+        }
+        if (matrix->getNRows() != this->_result.getNRows()
+            || matrix->getNCols() != this->_result.getNCols()) {
+            std::stringstream ss;
+            ss << "Matrix in " << _filename << " is " << matrix->getNRows() << 'x'
+               << matrix->getNCols() << " instead of "
+               << this->_result.getNRows() << 'x' << this->_result.getNCols();
+            this->fail(ss.str());
+            return;
+        }
+        if (matrix->getDType() == matfile::DTypeOf<T>::value) {
+            this->_result.attach(matrix->template as<T>(), matrix);
+        } else {
+            if (!this->allocateBuffer())
+                return;
+            matrix->copyRows(&this->_result.at(0, 0), 0, matrix->getNRows());
+        }
+        this->_result.shrinkNonzeroBox();
+    }
+
+    void makeSparse() {
+        if (_sparseDensity <= 0
+            || this->_result.countNonzeros() > _sparseDensity * this->_result.getTotalSize()) {
+            return;
+        }
+        std::unique_ptr<SparseMatrix<T>> sparse{new SparseMatrix<T>(this->_result.getNRows(),
+                                                                    this->_result.getNCols())};
+        // dense form stays if there is no memory for the sparse one
+        if (!sparse->assign(this->_result)) return;
+        this->_sparse = std::move(sparse);
+        this->_result.free();
+    }
+
 };
 
 
-class MatrixOp : public Lab2BaseTask {
+template <class T>
+class MatrixOp : public Lab2BaseTask<T> {
 
     const size_t _nArgs;
 
 public:
 
     MatrixOp(size_t nRows, size_t nCols, size_t nArgs)
-            : Lab2BaseTask(nRows, nCols), _nArgs(nArgs) {}
+            : Lab2BaseTask<T>(nRows, nCols), _nArgs(nArgs) {}
 
-    std::vector<Lab2BaseTask*> _dependencies;
+    std::vector<Lab2BaseTask<T>*> _dependencies;
 
 protected:
 
-    std::vector<MatrixBuffer*> _arguments;
+    std::vector<MatrixBuffer<T>*> _arguments;
 
     bool doStart(const std::vector<mt::Task*> &dependencies) override {
         for(auto dep : dependencies) {
-            auto argDep = dynamic_cast<Lab2BaseTask*>(dep);
+            auto argDep = dynamic_cast<Lab2BaseTask<T>*>(dep);
             if (argDep != nullptr) {
-                _dependencies.push_back(argDep);
-                _arguments.push_back(&argDep->_result);
+                this->_dependencies.push_back(argDep);
+                this->_arguments.push_back(&argDep->_result);
             }
         }
-        assert(_arguments.size() == _nArgs);
+        assert(this->_arguments.size() == _nArgs);
         return false;
     }
 
     bool isWaiting() override {
-        for(auto dep : _dependencies) {
+        for(auto dep : this->_dependencies) {
             if (!dep->isDone()) return true;
         }
         return false;
     }
 
     bool doWorkPortion() override {
-        if (!checkFail())
-            performOp();
+        SpillManager *spillManager = SpillManager::getCurrent();
+        {
+            SpillManager::Pin pin{spillManager, this->_dependencies};
+            if (!checkFail() && densifyArguments())
+                performOp();
+        }
+        // a result borrowed from an argument is not reserved by allocateBuffer()
+        if (spillManager != nullptr) spillManager->add(this);
         return true;
     }
 
     virtual void performOp() = 0;
 
+    // ops which can take sparse arguments override it
+    virtual bool needsDenseArguments() const { return true; }
+
+    bool densifyArguments() {
+        if (!needsDenseArguments()) return true;
+        for (auto dep : this->_dependencies) {
+            if (!dep->densify()) {
+                this->fail(dep->getFailCause());
+                return false;
+            }
+        }
+        return true;
+    }
+
     bool checkFail() {
-        for (auto dep : _dependencies) {
+        for (auto dep : this->_dependencies) {
             if (dep->hasFailed()) {
-                fail(dep->getFailCause());
+                this->fail(dep->getFailCause());
                 return true;
             }
         }
@@ -156,107 +367,366 @@ protected:
 };
 
 
-class Subscripting : public MatrixOp {
+template <class T>
+class Subscripting : public MatrixOp<T> {
 
     const size_t _rowOffs;
     const size_t _colOffs;
 
 public:
     Subscripting(size_t nRows, size_t nCols, size_t rowOffs, size_t colOffs)
-            : MatrixOp(nRows, nCols, 1)
+            : MatrixOp<T>(nRows, nCols, 1)
             , _rowOffs(rowOffs)
             , _colOffs(colOffs)
     {}
 
+    std::string getSignature() const override {
+        return this->signature("sub", std::to_string(_rowOffs) + ' ' + std::to_string(_colOffs));
+    }
+
 protected:
 
     void performOp() override {
-        if (!allocateBuffer()) return;
-        _result.set(*_arguments[0],
-                    0, 0, // where to start filling our result
-                    _rowOffs, _colOffs, // where to take data from argument
-                    _result.getNRows(), _result.getNCols() // how many to take
+        if (!this->allocateBuffer()) return;
+        this->_result.set(*this->_arguments[0],
+                          0, 0, // where to start filling our result
+                          _rowOffs, _colOffs, // where to take data from argument
+                          this->_result.getNRows(), this->_result.getNCols() // how many to take
         );
     }
 
 };
 
 
-class Addition : public MatrixOp {
+template <class T>
+class Addition : public MatrixOp<T> {
 
     const bool _borrowFromFirst;
-    const float _coeff;
+    const T _coeff;
 
 public:
-    Addition(size_t nRows, size_t nCols, float coeff=1, bool borrow=false)
-            : MatrixOp(nRows, nCols, 2), _coeff(coeff), _borrowFromFirst(borrow) {}
+    Addition(size_t nRows, size_t nCols, T coeff=1, bool borrow=false)
+            : MatrixOp<T>(nRows, nCols, 2), _coeff(coeff), _borrowFromFirst(borrow) {}
+
+    // a borrowed first argument is changed in place, so it may have no other users
+    std::string getSignature() const override {
+        return _borrowFromFirst ? "" : this->signature("add", this->formatCoeffs({_coeff}));
+    }
 
 protected:
 
     void performOp() override {
         if (_borrowFromFirst) {
-            _result.borrow(*_arguments[0]);
-            _result.add(*_arguments[1], _coeff);
+            this->_result.borrow(*this->_arguments[0]);
+            this->_result.add(*this->_arguments[1], _coeff);
         } else {
-            if (!allocateBuffer()) return;
-            _result.sum(*_arguments[0], *_arguments[1], _coeff);
+            if (!this->allocateBuffer()) return;
+            this->_result = *this->_arguments[0] + _coeff * *this->_arguments[1];
         }
     }
 
 };
 
 
-class Multiplication : public MatrixOp {
+// Sum of coeffs[i]*arguments[i] over any number of arguments, computed in one pass
+template <class T>
+class LinearCombination : public MatrixOp<T> {
+
+    const std::vector<T> _coeffs;
+
+public:
+    LinearCombination(size_t nRows, size_t nCols, const std::vector<T> &coeffs)
+            : MatrixOp<T>(nRows, nCols, coeffs.size()), _coeffs(coeffs) {}
+
+    std::string getSignature() const override {
+        return this->signature("combine", this->formatCoeffs(_coeffs));
+    }
+
+protected:
+
+    void performOp() override {
+        if (!this->allocateBuffer()) return;
+        this->_result.combine(this->_arguments, _coeffs);
+    }
+
+};
+
+
+template <class T>
+class Multiplication : public MatrixOp<T> {
 public:
-    Multiplication(size_t nRows, size_t nCols) : MatrixOp(nRows, nCols, 2) {}
+    Multiplication(size_t nRows, size_t nCols) : MatrixOp<T>(nRows, nCols, 2) {}
+
+    std::string getSignature() const override { return this->signature("mul"); }
+
+    void onAdded(const std::vector<mt::Task*> &dependencies) override {
+        auto right = dynamic_cast<Lab2BaseTask<T>*>(dependencies[1]);
+        if (right != nullptr) right->addPackUser();
+    }
 
 protected:
 
     void performOp() override {
-        if (!allocateBuffer()) return;
-        _result.mul(*_arguments[0], *_arguments[1]);
+        if (!this->allocateBuffer()) return;
+        // the right operand is packed once for all multiplications sharing it
+        auto right = this->_dependencies[1];
+        auto packed = right->getPacked();
+        if (packed != nullptr) {
+            this->_result.mulPacked(*this->_arguments[0], *this->_arguments[1], *packed);
+            right->releasePacked();
+        } else {
+            this->_result.mul(*this->_arguments[0], *this->_arguments[1]);
+        }
     }
 
 };
 
 
-class BlockMatrix : public MatrixOp {
+template <class T>
+class WinogradMultiplication : public MatrixOp<T> {
+
+    const size_t _limit;
+    const bool _morton;
+
 public:
-    BlockMatrix(size_t nRows, size_t nCols) : MatrixOp(nRows, nCols, 4) {}
+    // with `morton` operands are converted to Morton layout for the multiplication
+    WinogradMultiplication(size_t nRows, size_t nCols, size_t limit, bool morton = false)
+            : MatrixOp<T>(nRows, nCols, 2), _limit(limit), _morton(morton) {}
+
+    std::string getSignature() const override {
+        return this->signature("winograd", std::to_string(_limit) + (_morton ? " morton" : ""));
+    }
 
 protected:
 
     void performOp() override {
-        if (!allocateBuffer()) return;
-        _result.set(*_arguments[0], 0,                         0);
-        _result.set(*_arguments[1], 0,                         _arguments[0]->getNCols());
-        _result.set(*_arguments[2], _arguments[0]->getNRows(), 0);
-        _result.set(*_arguments[3], _arguments[0]->getNRows(), _arguments[0]->getNCols());
+        if (!this->allocateBuffer()) return;
+        this->_result.mul(*this->_arguments[0], *this->_arguments[1],
+                          [this] (MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+            std::vector<T> workspace;
+            try {
+                workspace.resize(_morton
+                                 ? mortonMulWorkspaceSize(m1.nRows, m1.nCols, m2.nCols, _limit)
+                                 : winogradWorkspaceSize(m1.nRows, m1.nCols, m2.nCols, _limit));
+            } catch (const std::bad_alloc&) {
+                this->fail("Cannot allocate workspace for task #" + std::to_string(this->getId()));
+                return;
+            }
+            if (_morton) {
+                mortonMul<T>(dst, m1, m2, workspace.data(), _limit);
+            } else {
+                winogradMul<T>(dst, m1, m2, workspace.data(), _limit);
+            }
+        });
     }
 
 };
 
 
+template <class T>
+class SchemeMultiplication : public MatrixOp<T> {
+
+    const SchemeList _schemes;
+    const size_t _level;
+    const size_t _limit;
+
+public:
+    SchemeMultiplication(size_t nRows, size_t nCols,
+                         const SchemeList &schemes, size_t level, size_t limit)
+            : MatrixOp<T>(nRows, nCols, 2), _schemes(schemes), _level(level), _limit(limit) {}
+
+    std::string getSignature() const override {
+        std::string params = std::to_string(_level) + ' ' + std::to_string(_limit);
+        for (auto scheme : _schemes) params += ' ' + scheme->name;
+        return this->signature("scheme", params);
+    }
+
+protected:
+
+    void performOp() override {
+        if (!this->allocateBuffer()) return;
+        this->_result.mul(*this->_arguments[0], *this->_arguments[1],
+                          [this] (MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+            std::vector<T> workspace;
+            try {
+                workspace.resize(schemeWorkspaceSize(
+                        _schemes, _level, m1.nRows, m1.nCols, m2.nCols, _limit));
+            } catch (const std::bad_alloc&) {
+                this->fail("Cannot allocate workspace for task #" + std::to_string(this->getId()));
+                return;
+            }
+            schemeMul<T>(dst, m1, m2, _schemes, _level, workspace.data(), _limit);
+        });
+    }
+
+};
+
+
+// Assembles a matrix from a grid of blocks, arguments go in row-major order
+template <class T>
+class BlockMatrix : public MatrixOp<T> {
+
+    const size_t _nBlockRows, _nBlockCols;
+
+public:
+    BlockMatrix(size_t nRows, size_t nCols, size_t nBlockRows = 2, size_t nBlockCols = 2)
+            : MatrixOp<T>(nRows, nCols, nBlockRows*nBlockCols)
+            , _nBlockRows(nBlockRows)
+            , _nBlockCols(nBlockCols) {}
+
+    std::string getSignature() const override {
+        return this->signature("blocks", std::to_string(_nBlockRows) + ' ' + std::to_string(_nBlockCols));
+    }
+
+protected:
+
+    void performOp() override {
+        if (!this->allocateBuffer()) return;
+        size_t rowOffs = 0;
+        for (size_t i = 0; i < _nBlockRows; i++) {
+            size_t colOffs = 0;
+            for (size_t j = 0; j < _nBlockCols; j++) {
+                const auto &block = *this->_arguments[i*_nBlockCols + j];
+                this->_result.set(block, rowOffs, colOffs);
+                colOffs += block.getNCols();
+            }
+            rowOffs += this->_arguments[i*_nBlockCols]->getNRows();
+        }
+    }
+
+};
+
+
+// Rows [rowBegin, rowBegin + nRows) of the product of two matrices, at least one of them
+// expected to be sparse. The left one is taken in sparse form, converted from dense if it
+// has none. The result is sparse with `sparseResult` when both arguments are sparse.
+template <class T>
+class SparseMultiplication : public MatrixOp<T> {
+
+    const size_t _rowBegin;
+    const bool _sparseResult;
+
+public:
+    SparseMultiplication(size_t nRows, size_t nCols, size_t rowBegin, bool sparseResult)
+            : MatrixOp<T>(nRows, nCols, 2), _rowBegin(rowBegin), _sparseResult(sparseResult) {}
+
+    std::string getSignature() const override {
+        return this->signature("spmul", std::to_string(_rowBegin) + (_sparseResult ? " sparse" : ""));
+    }
+
+protected:
+
+    bool needsDenseArguments() const override { return false; }
+
+    void performOp() override {
+        const SparseMatrix<T> *m1 = this->_dependencies[0]->getSparse();
+        const SparseMatrix<T> *m2 = this->_dependencies[1]->getSparse();
+        size_t rowBegin = _rowBegin;
+        std::unique_ptr<SparseMatrix<T>> band;
+        if (m1 == nullptr) {
+            band.reset(new SparseMatrix<T>(this->_result.getNRows(), this->_arguments[0]->getNCols()));
+            if (!band->assign(*this->_arguments[0], _rowBegin)) {
+                this->fail("Cannot allocate sparse matrix for task #" + std::to_string(this->getId()));
+                return;
+            }
+            m1 = band.get();
+            rowBegin = 0;
+        }
+        if (m2 != nullptr && _sparseResult) {
+            this->_sparse.reset(new SparseMatrix<T>(this->_result.getNRows(), this->_result.getNCols()));
+            if (!this->_sparse->mul(*m1, *m2, rowBegin)) {
+                this->_sparse.reset();
+                this->fail("Cannot allocate sparse matrix for task #" + std::to_string(this->getId()));
+            }
+            return;
+        }
+        if (!this->allocateBuffer()) return;
+        if (m2 != nullptr) {
+            SparseMatrix<T>::mul(this->_result, *m1, *m2, rowBegin);
+        } else {
+            SparseMatrix<T>::mul(this->_result, *m1, *this->_arguments[1], rowBegin);
+        }
+    }
+
+};
+
+
+// Stacks row bands computed by separate tasks; the result is sparse if all of them are
+template <class T>
+class RowBands : public MatrixOp<T> {
+public:
+    RowBands(size_t nRows, size_t nCols, size_t nBands) : MatrixOp<T>(nRows, nCols, nBands) {}
+
+    std::string getSignature() const override { return this->signature("bands"); }
+
+protected:
+
+    bool needsDenseArguments() const override { return false; }
+
+    void performOp() override {
+        std::vector<const SparseMatrix<T>*> parts;
+        for (auto dep : this->_dependencies) {
+            if (dep->getSparse() != nullptr) parts.push_back(dep->getSparse());
+        }
+        if (parts.size() == this->_dependencies.size()) {
+            this->_sparse.reset(new SparseMatrix<T>(this->_result.getNRows(), this->_result.getNCols()));
+            if (!this->_sparse->concat(parts)) {
+                this->_sparse.reset();
+                this->fail("Cannot allocate sparse matrix for task #" + std::to_string(this->getId()));
+            }
+            return;
+        }
+        if (!this->allocateBuffer()) return;
+        size_t rowOffs = 0;
+        for (size_t i = 0; i < this->_dependencies.size(); i++) {
+            const SparseMatrix<T> *sparse = this->_dependencies[i]->getSparse();
+            if (sparse != nullptr) {
+                sparse->copyTo(this->_result, rowOffs);
+            } else {
+                this->_result.set(*this->_arguments[i], rowOffs, 0);
+            }
+            rowOffs += this->_arguments[i]->getNRows();
+        }
+        this->_result.shrinkNonzeroBox();
+    }
+
+};
+
+
+template <class T>
 class MatrixWriter : public mt::Task {
     const std::string _filename;
     const size_t _nRows;
     const size_t _nCols;
+    const matfile::Format _format;
+    const unsigned _nFormatThreads;
 
-    Lab2BaseTask* _source;
+    Lab2BaseTask<T>* _source;
+
+    std::string _error;
+    std::chrono::steady_clock::time_point _doneTime;
 
 public:
+    // text is formatted on up to nFormatThreads threads
     MatrixWriter(const std::string &filename,
-                 const size_t nRows, const size_t nCols)
+                 const size_t nRows, const size_t nCols,
+                 matfile::Format format = matfile::TEXT, unsigned nFormatThreads = 1)
             : _filename(filename)
             , _nRows(nRows)
             , _nCols(nCols)
+            , _format(format)
+            , _nFormatThreads(nFormatThreads)
     {}
 
+    // why the output was not written, empty if it was; valid when the task is done
+    const std::string& getError() const { return _error; }
+    std::chrono::steady_clock::time_point getDoneTime() const { return _doneTime; }
+
 protected:
 
     bool doStart(const std::vector<mt::Task*>& deps) override {
         assert(deps.size() == 1);
-        _source = dynamic_cast<Lab2BaseTask*>(deps[0]);
+        _source = dynamic_cast<Lab2BaseTask<T>*>(deps[0]);
         assert(_source != nullptr);
         return false;
     }
@@ -266,19 +736,68 @@ protected:
     }
 
     bool doWorkPortion() override {
-        if (_source->hasFailed()) return true;
-        std::ofstream file{_filename};
-        auto &data = _source->_result;
-        for(size_t row = 0; row < _nRows; row++) {
-            for(size_t col = 0; col < _nCols; col++) {
-                file << data.at(row, col) << ' ';
-            }
-            file << '\n';
+        write();
+        _doneTime = std::chrono::steady_clock::now();
+        return true;
+    }
+
+private:
+
+    void write() {
+        if (_source->hasFailed()) {
+            _error = _source->getFailCause();
+            return;
+        }
+        SpillManager::Pin pin{SpillManager::getCurrent(), std::vector<Lab2BaseTask<T>*>{_source}};
+        if (!_source->densify()) {
+            _error = _source->getFailCause();
+            return;
+        }
+        ConstMatrixView<T> data = static_cast<const MatrixBuffer<T>&>(_source->_result).view();
+        try {
+            matfile::MatrixFileWriter file{_filename, _format};
+            file.writeRows(data.data, _nRows, _nCols, data.stride, _nFormatThreads);
+            file.close();
+        } catch (const std::runtime_error &err) {
+            _error = err.what();
+        }
+    }
+
+};
+
+
+// Stores the result of its source in a result cache under given key
+template <class T>
+class CacheWriter : public MatrixWriter<T> {
+    matfile::ResultCache *_cache;
+    const std::string _key;
+    const std::string _tempPath;
+
+public:
+    CacheWriter(matfile::ResultCache *cache, const std::string &key, size_t nRows, size_t nCols)
+            : CacheWriter(cache, key, cache->getTempPath(key), nRows, nCols) {}
+
+protected:
+
+    bool doWorkPortion() override {
+        MatrixWriter<T>::doWorkPortion();
+        if (this->getError().empty()) {
+            _cache->insert(_key, _tempPath);
+        } else {
+            _cache->discard(_tempPath);
         }
-        file.close();
         return true;
     }
 
+private:
+
+    CacheWriter(matfile::ResultCache *cache, const std::string &key, const std::string &tempPath,
+                size_t nRows, size_t nCols)
+            : MatrixWriter<T>(tempPath, nRows, nCols, matfile::BINARY)
+            , _cache(cache)
+            , _key(key)
+            , _tempPath(tempPath) {}
+
 };
 
 
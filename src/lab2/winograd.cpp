@@ -0,0 +1,82 @@
+#include "winograd.h"
+#include "kernels.h"
+#include "dtypes.h"
+#include <algorithm>
+
+
+namespace {
+
+bool isLeaf(size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    return std::min(nRows, std::min(nInner, nCols)) <= limit;
+}
+
+}
+
+
+size_t lab2::winogradWorkspaceSize(size_t nRows, size_t nInner, size_t nCols, size_t limit) {
+    if (isLeaf(nRows, nInner, nCols, limit)) return 0;
+    // odd rows and columns are peeled off, see winogradMul
+    size_t m = nRows / 2, k = nInner / 2, n = nCols / 2;
+    return std::max(m*k, m*n) + k*n + winogradWorkspaceSize(m, k, n, limit);
+}
+
+template <class T>
+void lab2::winogradMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+                       T *workspace, size_t limit) {
+    if (isLeaf(m1.nRows, m1.nCols, m2.nCols, limit)) {
+        kernels::mul<T>(dst, m1, m2);
+        return;
+    }
+    if (kernels::peel<T>(dst, m1, m2, 2, 2, 2,
+                         [workspace, limit] (MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2) {
+                             winogradMul<T>(dst, m1, m2, workspace, limit);
+                         })) {
+        return;
+    }
+    size_t m = m1.nRows / 2, k = m1.nCols / 2, n = m2.nCols / 2;
+
+    ConstMatrixView<T> A11 = m1.quadrant(0, 0), A12 = m1.quadrant(0, 1),
+                       A21 = m1.quadrant(1, 0), A22 = m1.quadrant(1, 1);
+    ConstMatrixView<T> B11 = m2.quadrant(0, 0), B12 = m2.quadrant(0, 1),
+                       B21 = m2.quadrant(1, 0), B22 = m2.quadrant(1, 1);
+    MatrixView<T> C11 = dst.quadrant(0, 0), C12 = dst.quadrant(0, 1),
+                  C21 = dst.quadrant(1, 0), C22 = dst.quadrant(1, 1);
+
+    // X holds sums of A quadrants and later the P1 product, Y holds sums of B quadrants
+    MatrixView<T> X{workspace, m, k};
+    MatrixView<T> XP{workspace, m, n};
+    MatrixView<T> Y{workspace + std::max(m*k, m*n), k, n};
+    T *deeper = Y.data + k*n;
+
+    // the schedule is taken from Boyer, Dumas, Pernet, Zhou,
+    // "Memory efficient scheduling of Strassen-Winograd's matrix multiplication algorithm"
+    kernels::sum<T>(X, A11, A21, -1);               // S3 = A11 - A21
+    kernels::sum<T>(Y, B22, B12, -1);               // T3 = B22 - B12
+    winogradMul<T>(C21, X, Y, deeper, limit);       // P7 = S3 * T3
+    kernels::sum<T>(X, A21, A22);                   // S1 = A21 + A22
+    kernels::sum<T>(Y, B12, B11, -1);               // T1 = B12 - B11
+    winogradMul<T>(C22, X, Y, deeper, limit);       // P5 = S1 * T1
+    kernels::sum<T>(X, X, A11, -1);                 // S2 = S1 - A11
+    kernels::sum<T>(Y, B22, Y, -1);                 // T2 = B22 - T1
+    winogradMul<T>(C12, X, Y, deeper, limit);       // P6 = S2 * T2
+    kernels::sum<T>(X, A12, X, -1);                 // S4 = A12 - S2
+    winogradMul<T>(C11, X, B22, deeper, limit);     // P3 = S4 * B22
+    winogradMul<T>(XP, A11, B11, deeper, limit);    // P1 = A11 * B11
+    kernels::sum<T>(C12, XP, C12);                  // U2 = P1 + P6
+    kernels::sum<T>(C21, C12, C21);                 // U3 = U2 + P7
+    kernels::sum<T>(C12, C12, C22);                 // U4 = U2 + P5
+    kernels::sum<T>(C22, C21, C22);                 // U7 = U3 + P5  -> C22
+    kernels::sum<T>(C12, C12, C11);                 // U5 = U4 + P3  -> C12
+    kernels::sum<T>(Y, Y, B21, -1);                 // T4 = T2 - B21
+    winogradMul<T>(C11, A22, Y, deeper, limit);     // P4 = A22 * T4
+    kernels::sum<T>(C21, C21, C11, -1);             // U6 = U3 - P4  -> C21
+    winogradMul<T>(C11, A12, B21, deeper, limit);   // P2 = A12 * B21
+    kernels::sum<T>(C11, XP, C11);                  // U1 = P1 + P2  -> C11
+}
+
+
+#define INSTANTIATE_WINOGRAD(T) \
+    template void lab2::winogradMul<T>(lab2::MatrixView<T>, lab2::ConstMatrixView<T>, \
+                                       lab2::ConstMatrixView<T>, T*, size_t);
+
+LAB2_FOR_EACH_DTYPE(INSTANTIATE_WINOGRAD)
@@ -0,0 +1,22 @@
+#ifndef MTP_LAB1_WINOGRAD_H
+#define MTP_LAB1_WINOGRAD_H
+
+#include "MatrixView.h"
+
+
+namespace lab2 {
+
+// Number of elements of scratch memory needed by winogradMul for given dimensions:
+// two temporaries per recursion level, which sums up to about 2/3 of the result size.
+size_t winogradWorkspaceSize(size_t nRows, size_t nInner, size_t nCols, size_t limit);
+
+// Sequential Strassen-Winograd multiplication (7 products, 15 additions per level).
+// Quadrants of `dst` are used to hold intermediate products, all other temporaries
+// live in `workspace`, which must hold at least winogradWorkspaceSize(...) elements.
+template <class T>
+void winogradMul(MatrixView<T> dst, ConstMatrixView<T> m1, ConstMatrixView<T> m2,
+                 T *workspace, size_t limit);
+
+}
+
+#endif //MTP_LAB1_WINOGRAD_H
@@ -0,0 +1,35 @@
+#include "MappedFile.h"
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+matfile::MappedFile::MappedFile(const std::string &path, bool writable)
+        : _path(path), _data(nullptr), _size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot open " + path);
+    }
+    _size = (size_t)st.st_size;
+    if (_size == 0) {
+        // mmap() refuses empty mappings
+        close(fd);
+        return;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *mapping = mmap(nullptr, _size, prot, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+    _data = static_cast<char*>(mapping);
+    // files are read once front to back by all the readers
+    madvise(mapping, _size, MADV_SEQUENTIAL);
+}
+
+matfile::MappedFile::~MappedFile() {
+    if (_data != nullptr) munmap(_data, _size);
+}
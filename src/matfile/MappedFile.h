@@ -0,0 +1,36 @@
+#ifndef MTP_LAB1_MAPPEDFILE_H
+#define MTP_LAB1_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+
+namespace matfile {
+
+// Whole file mapped into memory, throws std::runtime_error if it cannot be opened.
+// A writable mapping is copy-on-write: changes are never written back to the file.
+class MappedFile {
+
+public:
+
+    explicit MappedFile(const std::string &path, bool writable = false);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::string& getPath() const { return _path; }
+    size_t getSize() const { return _size; }
+    const char* getData() const { return _data; }
+    char* getData() { return _data; }
+
+private:
+    std::string _path;
+    char *_data;
+    size_t _size;
+
+};
+
+}
+
+#endif //MTP_LAB1_MAPPEDFILE_H
@@ -0,0 +1,143 @@
+#include "MatrixFile.h"
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+
+
+namespace {
+
+const char MAGIC[8] = {'M', 'T', 'P', 'M', 'A', 'T', 'R', 'X'};
+
+}
+
+
+size_t matfile::dtypeSize(DType dtype) {
+    switch (dtype) {
+        case FLOAT32: return sizeof(float);
+        case FLOAT64: return sizeof(double);
+        case INT32:   return sizeof(int32_t);
+        case INT64:   return sizeof(int64_t);
+    }
+    return 0;
+}
+
+const char* matfile::dtypeName(DType dtype) {
+    switch (dtype) {
+        case FLOAT32: return "float";
+        case FLOAT64: return "double";
+        case INT32:   return "int32";
+        case INT64:   return "int64";
+    }
+    return "unknown";
+}
+
+bool matfile::parseDType(const std::string &name, DType &dtype) {
+    for (DType d : {FLOAT32, FLOAT64, INT32, INT64}) {
+        if (name == dtypeName(d)) {
+            dtype = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t matfile::checksum(const void *data, size_t nBytes) {
+    Checksum sum;
+    sum.add(data, nBytes);
+    return sum.get();
+}
+
+void matfile::Checksum::addWord(const void *word) {
+    uint64_t value;
+    std::memcpy(&value, word, sizeof(uint64_t));
+    _sum += value;
+    _sumOfSums += _sum;
+}
+
+void matfile::Checksum::add(const void *data, size_t nBytes) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    if (_tailSize > 0) {
+        size_t n = std::min(nBytes, sizeof(_tail) - _tailSize);
+        std::memcpy(_tail + _tailSize, bytes, n);
+        _tailSize += n;
+        bytes += n;
+        nBytes -= n;
+        if (_tailSize < sizeof(_tail)) return;
+        addWord(_tail);
+        _tailSize = 0;
+    }
+    for (; nBytes >= sizeof(uint64_t); bytes += sizeof(uint64_t), nBytes -= sizeof(uint64_t)) {
+        addWord(bytes);
+    }
+    std::memcpy(_tail, bytes, nBytes);
+    _tailSize = nBytes;
+}
+
+uint64_t matfile::Checksum::get() const {
+    if (_tailSize == 0) return _sum ^ _sumOfSums;
+    unsigned char word[sizeof(uint64_t)] = {};
+    std::memcpy(word, _tail, _tailSize);
+    Checksum last = *this;
+    last._tailSize = 0;
+    last.addWord(word);
+    return last._sum ^ last._sumOfSums;
+}
+
+matfile::Header matfile::makeHeader(size_t nRows, size_t nCols, DType dtype, uint64_t checksum) {
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.dtype = dtype;
+    header.layout = ROW_MAJOR;
+    header.nRows = nRows;
+    header.nCols = nCols;
+    header.checksum = checksum;
+    return header;
+}
+
+bool matfile::isMatrixFile(const std::string &path) {
+    std::ifstream file{path, std::ios::binary};
+    char magic[sizeof(MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+
+matfile::MappedMatrix::MappedMatrix(const std::string &path)
+        : _file(path, true), _data(nullptr) {
+    if (_file.getSize() < sizeof(Header)) {
+        throw std::runtime_error("Matrix file " + path + " is too short");
+    }
+    std::memcpy(&_header, _file.getData(), sizeof(Header));
+    std::string error;
+    if (std::memcmp(_header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        error = "is not a binary matrix file";
+    } else if (_header.version != VERSION) {
+        error = "has unsupported version " + std::to_string(_header.version);
+    } else if (dtypeSize(DType(_header.dtype)) == 0) {
+        error = "has unknown element type";
+    } else if (_header.layout != ROW_MAJOR) {
+        error = "has unknown layout";
+    } else if (_file.getSize() - sizeof(Header) < _header.nRows*_header.nCols*dtypeSize(getDType())) {
+        error = "is truncated";
+    }
+    if (!error.empty()) throw std::runtime_error("Matrix file " + path + " " + error);
+    _data = _file.getData() + sizeof(Header);
+}
+
+bool matfile::MappedMatrix::verifyChecksum() const {
+    return checksum(_data, _header.nRows*_header.nCols*dtypeSize(getDType())) == _header.checksum;
+}
+
+
+void matfile::writeMatrixFile(const std::string &path, size_t nRows, size_t nCols,
+                              DType dtype, const void *data) {
+    size_t nBytes = nRows*nCols*dtypeSize(dtype);
+    Header header = makeHeader(nRows, nCols, dtype, checksum(data, nBytes));
+
+    std::ofstream file{path, std::ios::binary};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(static_cast<const char*>(data), nBytes);
+    file.close();
+    if (!file) throw std::runtime_error("Cannot write matrix file " + path);
+}
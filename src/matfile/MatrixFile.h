@@ -0,0 +1,138 @@
+#ifndef MTP_LAB1_MATRIXFILE_H
+#define MTP_LAB1_MATRIXFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include "MappedFile.h"
+
+
+// Binary matrix files: a 64-byte header followed by nRows*nCols elements in row-major
+// order, little-endian. The data starts at a 64-byte boundary, so a mapped file can be
+// used in place as a matrix of its element type. Scratch files of out-of-core computations
+// use tiled layout instead, see TiledMatrixFile.h.
+namespace matfile {
+
+enum DType : uint32_t { FLOAT32 = 1, FLOAT64 = 2, INT32 = 3, INT64 = 4 };
+enum Layout : uint32_t { ROW_MAJOR = 0, TILED = 1 };
+
+const uint32_t VERSION = 1;
+
+struct Header {
+    char magic[8];          // "MTPMATRX"
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    uint32_t tileSize;      // 0 unless layout is TILED
+    uint64_t nRows, nCols;
+    uint64_t checksum;      // see checksum() below, over the data only
+    char padding[16];
+};
+
+static_assert(sizeof(Header) == 64, "Header of matrix file must take 64 bytes");
+
+size_t dtypeSize(DType dtype);
+// "float", "double", "int32" and "int64", as for --dtype options
+const char* dtypeName(DType dtype);
+bool parseDType(const std::string &name, DType &dtype);
+
+template <class T> struct DTypeOf;
+template <> struct DTypeOf<float>   { static const DType value = FLOAT32; };
+template <> struct DTypeOf<double>  { static const DType value = FLOAT64; };
+template <> struct DTypeOf<int32_t> { static const DType value = INT32; };
+template <> struct DTypeOf<int64_t> { static const DType value = INT64; };
+
+// Two running sums of the data read as little-endian 64-bit words (zero-padded at
+// the end), in the spirit of Fletcher's checksum
+uint64_t checksum(const void *data, size_t nBytes);
+
+// the same checksum of data given in consecutive parts
+class Checksum {
+
+public:
+
+    void add(const void *data, size_t nBytes);
+    uint64_t get() const;
+
+private:
+    uint64_t _sum = 0, _sumOfSums = 0;
+    // bytes of the last incomplete word
+    unsigned char _tail[sizeof(uint64_t)];
+    size_t _tailSize = 0;
+
+    void addWord(const void *word);
+
+};
+
+Header makeHeader(size_t nRows, size_t nCols, DType dtype, uint64_t checksum);
+
+// true if the file starts with the magic of binary matrix files, otherwise it is text
+bool isMatrixFile(const std::string &path);
+
+
+// Read-only view of a binary matrix file mapped into memory; nothing is copied until
+// the data is touched. Throws std::runtime_error for missing or malformed files.
+class MappedMatrix {
+
+public:
+
+    explicit MappedMatrix(const std::string &path);
+
+    size_t getNRows() const { return _header.nRows; }
+    size_t getNCols() const { return _header.nCols; }
+    DType getDType() const { return DType(_header.dtype); }
+    const void* getData() const { return _data; }
+
+    // data in place, when stored with element type T. Pages are mapped copy-on-write,
+    // so writes through the non-const version change only this process's copy.
+    template <class T>
+    const T* as() const {
+        if (getDType() != DTypeOf<T>::value) {
+            throw std::runtime_error("Matrix file " + _file.getPath() + " stores " + dtypeName(getDType()));
+        }
+        return static_cast<const T*>(_data);
+    }
+    template <class T>
+    T* as() { return const_cast<T*>(static_cast<const MappedMatrix*>(this)->as<T>()); }
+
+    // copies rows [rowBegin, rowBegin + nRows) converting elements to T
+    template <class T>
+    void copyRows(T *dst, size_t rowBegin, size_t nRows) const;
+
+    bool verifyChecksum() const;
+
+private:
+    MappedFile _file;
+    Header _header;
+    const void *_data;
+
+    template <class T, class Src>
+    void convertRows(T *dst, size_t rowBegin, size_t nRows) const {
+        const Src *src = static_cast<const Src*>(_data) + rowBegin*_header.nCols;
+        for (size_t i = 0; i < nRows*_header.nCols; i++) dst[i] = static_cast<T>(src[i]);
+    }
+
+};
+
+template <class T>
+void MappedMatrix::copyRows(T *dst, size_t rowBegin, size_t nRows) const {
+    if (rowBegin + nRows > _header.nRows) {
+        throw std::runtime_error("Rows out of range of matrix file " + _file.getPath());
+    }
+    switch (getDType()) {
+        case FLOAT32: convertRows<T, float>(dst, rowBegin, nRows); break;
+        case FLOAT64: convertRows<T, double>(dst, rowBegin, nRows); break;
+        case INT32:   convertRows<T, int32_t>(dst, rowBegin, nRows); break;
+        case INT64:   convertRows<T, int64_t>(dst, rowBegin, nRows); break;
+    }
+}
+
+
+// Writes the whole matrix file at once, throws std::runtime_error on I/O errors
+void writeMatrixFile(const std::string &path, size_t nRows, size_t nCols,
+                     DType dtype, const void *data);
+
+}
+
+#endif //MTP_LAB1_MATRIXFILE_H
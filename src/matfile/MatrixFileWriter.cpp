@@ -0,0 +1,191 @@
+#include "MatrixFileWriter.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+
+// output is written in pieces of about this size
+const size_t BUFFER_SIZE = 1 << 22;
+// text rows are formatted in parallel in blocks of about this many numbers
+const size_t BLOCK_NUMBERS = 1 << 16;
+
+template <class I>
+size_t formatInteger(I value, char *dst) {
+    uint64_t u = value < 0 ? 0 - uint64_t(value) : uint64_t(value);
+    char digits[20];
+    size_t nDigits = 0;
+    do {
+        digits[nDigits++] = char('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    size_t length = 0;
+    if (value < 0) dst[length++] = '-';
+    while (nDigits > 0) dst[length++] = digits[--nDigits];
+    return length;
+}
+
+template <class F>
+size_t formatFloating(F value, char *dst) {
+    // %g prints integers of up to 6 digits as they are
+    if (value > -1e6 && value < 1e6 && value == F(int32_t(value))) {
+        if (value == 0 && std::signbit(value)) {
+            dst[0] = '-';
+            dst[1] = '0';
+            return 2;
+        }
+        return formatInteger(int32_t(value), dst);
+    }
+    return (size_t)std::snprintf(dst, matfile::MAX_NUMBER_LENGTH, "%g", double(value));
+}
+
+size_t format(float value, char *dst) { return formatFloating(value, dst); }
+size_t format(double value, char *dst) { return formatFloating(value, dst); }
+size_t format(int32_t value, char *dst) { return formatInteger(value, dst); }
+size_t format(int64_t value, char *dst) { return formatInteger(value, dst); }
+
+// Appends rows formatted as text, each number followed by a space
+template <class T>
+void formatRows(const T *data, size_t nRows, size_t nCols, size_t stride, std::vector<char> &out) {
+    size_t size = out.size();
+    out.resize(size + nRows*(nCols*(matfile::MAX_NUMBER_LENGTH + 1) + 1));
+    char *pos = out.data() + size;
+    for (size_t r = 0; r < nRows; r++) {
+        const T *row = data + r*stride;
+        for (size_t c = 0; c < nCols; c++) {
+            pos += format(row[c], pos);
+            *pos++ = ' ';
+        }
+        *pos++ = '\n';
+    }
+    out.resize(pos - out.data());
+}
+
+}
+
+
+template <class T>
+size_t matfile::formatNumber(T value, char *dst) {
+    return format(value, dst);
+}
+
+
+matfile::MatrixFileWriter::MatrixFileWriter(const std::string &path, Format format)
+        : _path(path), _format(format), _nRows(0), _nCols(0), _dtype(FLOAT32) {
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) throw std::runtime_error("Cannot create " + path);
+    _buffer.reserve(BUFFER_SIZE);
+    // the header is written over this place by close()
+    if (_format == BINARY) _buffer.resize(sizeof(Header), 0);
+}
+
+matfile::MatrixFileWriter::~MatrixFileWriter() {
+    try {
+        close();
+    } catch (const std::runtime_error&) {}
+}
+
+template <class T>
+void matfile::MatrixFileWriter::writeRows(const T *data, size_t nRows, size_t nCols, size_t stride,
+                                          unsigned nThreads) {
+    if (_fd < 0) throw std::runtime_error("Writing to closed file " + _path);
+    if (_format == BINARY) {
+        writeBinaryRows(data, nRows, nCols, stride);
+        return;
+    }
+    size_t blockRows = std::max<size_t>(1, BLOCK_NUMBERS / std::max<size_t>(1, nCols));
+    size_t nBlocks = (nRows + blockRows - 1) / blockRows;
+    if (nThreads <= 1 || nBlocks <= 1) {
+        for (size_t r = 0; r < nRows; r += blockRows) {
+            formatRows(data + r*stride, std::min(blockRows, nRows - r), nCols, stride, _buffer);
+            if (_buffer.size() >= BUFFER_SIZE) flush();
+        }
+        return;
+    }
+
+    // rounds of nThreads blocks formatted in parallel and written in order
+    std::vector<std::vector<char>> blocks(std::min<size_t>(nThreads, nBlocks));
+    flush();
+    for (size_t roundBegin = 0; roundBegin < nRows; roundBegin += blocks.size()*blockRows) {
+        auto formatBlock = [&] (size_t i) {
+            blocks[i].clear();
+            size_t begin = roundBegin + i*blockRows;
+            if (begin >= nRows) return;
+            formatRows(data + begin*stride, std::min(blockRows, nRows - begin), nCols, stride, blocks[i]);
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < blocks.size(); i++) threads.emplace_back(formatBlock, i);
+        formatBlock(0);
+        for (auto &t : threads) t.join();
+        for (const auto &block : blocks) writeAll(block.data(), block.size());
+    }
+}
+
+template <class T>
+void matfile::MatrixFileWriter::writeBinaryRows(const T *data, size_t nRows, size_t nCols, size_t stride) {
+    if (_nRows == 0) {
+        _dtype = DTypeOf<T>::value;
+        _nCols = nCols;
+    } else if (_dtype != DTypeOf<T>::value || _nCols != nCols) {
+        throw std::runtime_error("Rows of other shape or type written to " + _path);
+    }
+    for (size_t r = 0; r < nRows; r++) {
+        const char *row = reinterpret_cast<const char*>(data + r*stride);
+        _checksum.add(row, nCols*sizeof(T));
+        _buffer.insert(_buffer.end(), row, row + nCols*sizeof(T));
+        if (_buffer.size() >= BUFFER_SIZE) flush();
+    }
+    _nRows += nRows;
+}
+
+void matfile::MatrixFileWriter::close() {
+    if (_fd < 0) return;
+    try {
+        flush();
+        if (_format == BINARY) {
+            Header header = makeHeader(_nRows, _nCols, _dtype, _checksum.get());
+            if (pwrite(_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                throw std::runtime_error("Cannot write " + _path);
+            }
+        }
+    } catch (const std::runtime_error&) {
+        ::close(_fd);
+        _fd = -1;
+        throw;
+    }
+    int result = ::close(_fd);
+    _fd = -1;
+    if (result != 0) throw std::runtime_error("Cannot write " + _path);
+}
+
+void matfile::MatrixFileWriter::flush() {
+    writeAll(_buffer.data(), _buffer.size());
+    _buffer.clear();
+}
+
+void matfile::MatrixFileWriter::writeAll(const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(_fd, data, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) throw std::runtime_error("Cannot write " + _path);
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+
+#define INSTANTIATE_MATRIX_FILE_WRITER(T) \
+    template size_t matfile::formatNumber<T>(T, char*); \
+    template void matfile::MatrixFileWriter::writeRows<T>(const T*, size_t, size_t, size_t, unsigned);
+
+INSTANTIATE_MATRIX_FILE_WRITER(float)
+INSTANTIATE_MATRIX_FILE_WRITER(double)
+INSTANTIATE_MATRIX_FILE_WRITER(int32_t)
+INSTANTIATE_MATRIX_FILE_WRITER(int64_t)
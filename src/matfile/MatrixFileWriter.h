@@ -0,0 +1,64 @@
+#ifndef MTP_LAB1_MATRIXFILEWRITER_H
+#define MTP_LAB1_MATRIXFILEWRITER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "MatrixFile.h"
+
+
+namespace matfile {
+
+enum Format { TEXT, BINARY };
+
+// longest number written by formatNumber()
+const size_t MAX_NUMBER_LENGTH = 32;
+
+// Formats value as std::ostream << does with default flags and precision,
+// returns the number of characters written to dst
+template <class T>
+size_t formatNumber(T value, char *dst);
+
+
+// Writes a matrix to a file row by row. Text rows are formatted into large buffers,
+// in parallel for big blocks of rows, and written out with few write() calls; the header
+// of binary files is filled in by close(). Throws std::runtime_error on I/O errors.
+class MatrixFileWriter {
+
+public:
+
+    MatrixFileWriter(const std::string &path, Format format);
+    // closes the file, but errors are reported only by close()
+    ~MatrixFileWriter();
+
+    MatrixFileWriter(const MatrixFileWriter&) = delete;
+    MatrixFileWriter& operator=(const MatrixFileWriter&) = delete;
+
+    // Appends nRows rows of nCols elements, `stride` elements apart in `data`, formatting
+    // them on up to nThreads threads. Binary files keep the element type of the first rows.
+    template <class T>
+    void writeRows(const T *data, size_t nRows, size_t nCols, size_t stride, unsigned nThreads = 1);
+
+    void close();
+
+private:
+    const std::string _path;
+    const Format _format;
+    int _fd;
+    std::vector<char> _buffer;
+
+    // shape and contents of binary files, for their header
+    size_t _nRows, _nCols;
+    DType _dtype;
+    Checksum _checksum;
+
+    template <class T>
+    void writeBinaryRows(const T *data, size_t nRows, size_t nCols, size_t stride);
+    void flush();
+    void writeAll(const char *data, size_t size);
+
+};
+
+}
+
+#endif //MTP_LAB1_MATRIXFILEWRITER_H
@@ -0,0 +1,156 @@
+#include "ResultCache.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char SUFFIX[] = ".mat";
+
+// finalizer of MurmurHash3
+uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+uint64_t rotl(uint64_t x, unsigned r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// two lanes over little-endian 64-bit words, the last one zero-padded
+std::string hashBytes(const void *data, size_t nBytes) {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL, h2 = 0x632be59bd9b4e019ULL;
+    for (size_t i = 0; i < nBytes; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes + i, std::min(sizeof(uint64_t), nBytes - i));
+        h1 = rotl(h1 ^ mix(word), 31) * 0x87c37b91114253d5ULL;
+        h2 = rotl(h2 + mix(word ^ 0x4cf5ad432745937fULL), 27) * 5 + 0x52dce729;
+    }
+    h1 ^= nBytes;
+    h2 ^= nBytes;
+    h1 = mix(h1 + h2);
+    h2 = mix(h2 + h1);
+    char hex[33];
+    std::snprintf(hex, sizeof(hex), "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+    return hex;
+}
+
+int64_t now() {
+    timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+bool endsWith(const std::string &s, const std::string &suffix) {
+    return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+
+matfile::ResultCache::ResultCache(const std::string &dir, size_t maxBytes)
+        : _dir(dir), _maxBytes(maxBytes) {
+    if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create cache directory " + dir);
+    }
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) throw std::runtime_error("Cannot read cache directory " + dir);
+    while (dirent *item = readdir(d)) {
+        std::string name = item->d_name;
+        struct stat st;
+        if (!endsWith(name, SUFFIX) || stat((dir + "/" + name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        Entry entry{(size_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec};
+        _entries[name.substr(0, name.size() - sizeof(SUFFIX) + 1)] = entry;
+        _size += entry.bytes;
+    }
+    closedir(d);
+    std::unique_lock<std::mutex> _lk{_mtx};
+    evict("");
+}
+
+std::string matfile::ResultCache::keyOfFile(const std::string &path) {
+    MappedFile file{path};
+    return hashBytes(file.getData(), file.getSize());
+}
+
+std::string matfile::ResultCache::keyOf(const std::string &description) {
+    return hashBytes(description.data(), description.size());
+}
+
+std::string matfile::ResultCache::lookup(const std::string &key) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    auto it = _entries.find(key);
+    if (it == _entries.end()) return "";
+    std::string path = getPath(key);
+    // evicted by another process
+    if (utimensat(AT_FDCWD, path.c_str(), nullptr, 0) != 0) {
+        _size -= it->second.bytes;
+        _entries.erase(it);
+        return "";
+    }
+    it->second.lastUse = now();
+    return path;
+}
+
+std::string matfile::ResultCache::getTempPath(const std::string &key) {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    return _dir + "/" + key + "." + std::to_string(getpid()) + "." + std::to_string(_nTemps++) + ".tmp";
+}
+
+void matfile::ResultCache::insert(const std::string &key, const std::string &tempPath) {
+    struct stat st;
+    if (stat(tempPath.c_str(), &st) != 0 || (size_t)st.st_size > _maxBytes
+        || std::rename(tempPath.c_str(), getPath(key).c_str()) != 0) {
+        discard(tempPath);
+        return;
+    }
+    std::unique_lock<std::mutex> _lk{_mtx};
+    auto it = _entries.find(key);
+    if (it != _entries.end()) _size -= it->second.bytes;
+    _entries[key] = Entry{(size_t)st.st_size, now()};
+    _size += st.st_size;
+    evict(key);
+}
+
+void matfile::ResultCache::discard(const std::string &tempPath) {
+    std::remove(tempPath.c_str());
+}
+
+size_t matfile::ResultCache::getSize() const {
+    std::unique_lock<std::mutex> _lk{_mtx};
+    return _size;
+}
+
+std::string matfile::ResultCache::getPath(const std::string &key) const {
+    return _dir + "/" + key + SUFFIX;
+}
+
+void matfile::ResultCache::evict(const std::string &keep) {
+    while (_size > _maxBytes) {
+        auto victim = _entries.end();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->first == keep) continue;
+            if (victim == _entries.end() || it->second.lastUse < victim->second.lastUse) victim = it;
+        }
+        if (victim == _entries.end()) return;
+        std::remove(getPath(victim->first).c_str());
+        _size -= victim->second.bytes;
+        _entries.erase(victim);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef MTP_LAB1_RESULTCACHE_H
+#define MTP_LAB1_RESULTCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+
+
+namespace matfile {
+
+// Content-addressed store of results in binary matrix files. Keys are hashes: of
+// input file contents, and of descriptions of computations with the keys of their
+// inputs, so a result is found again whenever the same inputs are combined the same
+// way. Files over the size limit are evicted least recently used first; the last
+// use is kept as modification time of the files, so it survives between runs.
+// Several processes may share a directory. Methods are thread-safe.
+class ResultCache {
+
+public:
+
+    // throws std::runtime_error if the directory cannot be created or read
+    ResultCache(const std::string &dir, size_t maxBytes);
+
+    // Keys are 128-bit hashes in hex, not cryptographic ones. keyOfFile() throws
+    // std::runtime_error if the file cannot be read.
+    static std::string keyOfFile(const std::string &path);
+    static std::string keyOf(const std::string &description);
+
+    // path of the stored result, empty if there is none; marks it as used
+    std::string lookup(const std::string &key);
+
+    // where to write a result before it is inserted
+    std::string getTempPath(const std::string &key);
+    // Moves a complete file from getTempPath() into the cache and evicts the least
+    // recently used files over the limit; it is removed instead if it does not fit
+    void insert(const std::string &key, const std::string &tempPath);
+    void discard(const std::string &tempPath);
+
+    size_t getSize() const;
+
+private:
+    struct Entry {
+        size_t bytes;
+        int64_t lastUse;    // ns since the epoch
+    };
+
+    const std::string _dir;
+    const size_t _maxBytes;
+    std::map<std::string, Entry> _entries;
+    size_t _size = 0;
+    unsigned long _nTemps = 0;
+    mutable std::mutex _mtx;
+
+    std::string getPath(const std::string &key) const;
+    void evict(const std::string &keep);
+
+};
+
+}
+
+#endif //MTP_LAB1_RESULTCACHE_H
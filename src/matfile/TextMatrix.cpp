@@ -0,0 +1,258 @@
+#include "TextMatrix.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <type_traits>
+#include <stdexcept>
+#include <algorithm>
+
+
+namespace {
+
+// files are split between threads in chunks of at least this size
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c) { return unsigned(c - '0') < 10; }
+
+const char* skipSpace(const char *pos, const char *end) {
+    while (pos != end && isSpace(*pos)) pos++;
+    return pos;
+}
+
+const char* skipToken(const char *pos, const char *end) {
+    while (pos != end && !isSpace(*pos)) pos++;
+    return pos;
+}
+
+size_t countTokens(const char *pos, const char *end) {
+    size_t count = 0;
+    bool inToken = false;
+    for (; pos != end; pos++) {
+        bool space = isSpace(*pos);
+        if (!space && !inToken) count++;
+        inToken = !space;
+    }
+    return count;
+}
+
+
+// Decimal number as mantissa * 10^exponent, with up to 19 significant digits
+struct Decimal {
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    // no nonzero digits were dropped from the mantissa
+    bool exact = true;
+    bool integer = true;
+
+    void addDigit(char c) {
+        if (mantissa < 1000000000000000000ull) {
+            mantissa = mantissa*10 + (c - '0');
+        } else {
+            exact = exact && c == '0';
+            exponent++;
+        }
+    }
+};
+
+// false if the token is not a plain decimal number, e.g. hexadecimal, inf or nan
+bool scanDecimal(const char *pos, const char *end, Decimal &d) {
+    if (pos != end && (*pos == '-' || *pos == '+')) d.negative = *pos++ == '-';
+    size_t nDigits = 0;
+    for (; pos != end && isDigit(*pos); pos++, nDigits++) d.addDigit(*pos);
+    if (pos != end && *pos == '.') {
+        d.integer = false;
+        for (pos++; pos != end && isDigit(*pos); pos++, nDigits++) {
+            d.addDigit(*pos);
+            d.exponent--;
+        }
+    }
+    if (nDigits == 0) return false;
+    if (pos != end && (*pos == 'e' || *pos == 'E')) {
+        d.integer = false;
+        pos++;
+        bool negative = false;
+        if (pos != end && (*pos == '-' || *pos == '+')) negative = *pos++ == '-';
+        if (pos == end) return false;
+        int exponent = 0;
+        for (; pos != end && isDigit(*pos); pos++) {
+            if (exponent < 100000) exponent = exponent*10 + (*pos - '0');
+        }
+        d.exponent += negative ? -exponent : exponent;
+    }
+    return pos == end;
+}
+
+// Exact conversion when both the mantissa and the power of ten are exact doubles,
+// then the result is correctly rounded (Clinger's fast path)
+bool fastDouble(const Decimal &d, double &value) {
+    static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    if (!d.exact || d.mantissa > (uint64_t(1) << 53) || d.exponent < -22 || d.exponent > 22) {
+        return false;
+    }
+    value = double(d.mantissa);
+    value = d.exponent < 0 ? value / POW10[-d.exponent] : value * POW10[d.exponent];
+    if (d.negative) value = -value;
+    return true;
+}
+
+template <class F>
+bool slowFloating(const char *begin, const char *end, F &value) {
+    std::string token{begin, end};
+    char *parsedEnd;
+    value = std::is_same<F, float>::value ? std::strtof(token.c_str(), &parsedEnd)
+                                          : std::strtod(token.c_str(), &parsedEnd);
+    return parsedEnd == token.c_str() + token.size();
+}
+
+bool parse(const char *begin, const char *end, double &value) {
+    Decimal d;
+    if (scanDecimal(begin, end, d) && fastDouble(d, value)) return true;
+    return slowFloating(begin, end, value);
+}
+
+bool parse(const char *begin, const char *end, float &value) {
+    Decimal d;
+    double exact;
+    if (scanDecimal(begin, end, d) && fastDouble(d, exact)) {
+        // rounding the correctly rounded double once more gives the correctly
+        // rounded float, unless the double is exactly halfway between two floats
+        value = float(exact);
+        if (double(value) == exact) return true;
+        float other = std::nextafter(value, exact > value ? std::numeric_limits<float>::infinity()
+                                                          : -std::numeric_limits<float>::infinity());
+        if ((double(value) + double(other)) / 2 != exact) return true;
+    }
+    return slowFloating(begin, end, value);
+}
+
+template <class I>
+bool parseInteger(const char *begin, const char *end, I &value) {
+    Decimal d;
+    if (scanDecimal(begin, end, d) && d.integer && d.exact && d.exponent == 0) {
+        uint64_t limit = uint64_t(std::numeric_limits<I>::max()) + (d.negative ? 1 : 0);
+        if (d.mantissa > limit) return false;
+        value = I(d.negative ? 0 - d.mantissa : d.mantissa);
+        return true;
+    }
+    // other notations are accepted for integral values, e.g. 1e3 or 2.0
+    double real;
+    if (!parse(begin, end, real) || real != std::floor(real)
+        || real < double(std::numeric_limits<I>::min())
+        || real >= -double(std::numeric_limits<I>::min())) {
+        return false;
+    }
+    value = I(real);
+    return true;
+}
+
+bool parse(const char *begin, const char *end, int32_t &value) { return parseInteger(begin, end, value); }
+bool parse(const char *begin, const char *end, int64_t &value) { return parseInteger(begin, end, value); }
+
+
+// Parses whitespace-separated numbers of [pos, end) into dst[0..n)
+template <class T>
+void parseTokens(const std::string &path, const char *pos, const char *end, T *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        pos = skipSpace(pos, end);
+        const char *tokenEnd = skipToken(pos, end);
+        if (!parse(pos, tokenEnd, dst[i])) {
+            throw std::runtime_error("Bad number \"" + std::string(pos, tokenEnd) + "\" in " + path);
+        }
+        pos = tokenEnd;
+    }
+}
+
+}
+
+
+template <class T>
+bool matfile::parseNumber(const char *begin, const char *end, T &value) {
+    return parse(begin, end, value);
+}
+
+
+matfile::TextMatrixReader::TextMatrixReader(const std::string &path)
+        : _file(path), _pos(_file.getData()), _nRead(0) {}
+
+template <class T>
+void matfile::TextMatrixReader::read(T *dst, size_t n) {
+    const char *end = _file.getData() + _file.getSize();
+    for (size_t i = 0; i < n; i++) {
+        const char *pos = skipSpace(_pos, end);
+        if (pos == end) {
+            throw std::runtime_error(_file.getPath() + " has only " + std::to_string(_nRead) + " numbers");
+        }
+        _pos = skipToken(pos, end);
+        parseTokens(_file.getPath(), pos, _pos, dst + i, 1);
+        _nRead++;
+    }
+}
+
+template <class T>
+void matfile::TextMatrixReader::readAll(T *dst, size_t n, unsigned nThreads) {
+    const char *begin = _file.getData(), *end = begin + _file.getSize();
+    size_t nChunks = std::max<size_t>(1, std::min<size_t>(nThreads, _file.getSize() / MIN_CHUNK_SIZE));
+
+    // chunks are split at whitespace, so each number lies in a single chunk
+    std::vector<const char*> bounds(nChunks + 1, begin);
+    for (size_t i = 1; i < nChunks; i++) {
+        bounds[i] = std::max(bounds[i - 1], skipToken(begin + _file.getSize()*i/nChunks, end));
+    }
+    bounds[nChunks] = end;
+
+    // the first pass finds where numbers of each chunk go, the second one parses them
+    std::vector<size_t> offsets(nChunks + 1, 0);
+    std::vector<std::string> errors(nChunks);
+    auto runChunks = [&] (const std::function<void(size_t)> &work) {
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < nChunks; i++) {
+            threads.emplace_back([&, i] {
+                try {
+                    work(i);
+                } catch (const std::runtime_error &err) {
+                    errors[i] = err.what();
+                }
+            });
+        }
+        try {
+            work(0);
+        } catch (const std::runtime_error &err) {
+            errors[0] = err.what();
+        }
+        for (auto &t : threads) t.join();
+        for (const auto &error : errors) {
+            if (!error.empty()) throw std::runtime_error(error);
+        }
+    };
+    runChunks([&] (size_t i) { offsets[i + 1] = countTokens(bounds[i], bounds[i + 1]); });
+    for (size_t i = 0; i < nChunks; i++) offsets[i + 1] += offsets[i];
+    if (offsets[nChunks] < n) {
+        throw std::runtime_error(_file.getPath() + " has only " + std::to_string(offsets[nChunks]) + " numbers");
+    }
+    runChunks([&] (size_t i) {
+        if (offsets[i] >= n) return;
+        parseTokens(_file.getPath(), bounds[i], bounds[i + 1], dst + offsets[i],
+                    std::min(offsets[i + 1], n) - offsets[i]);
+    });
+}
+
+
+#define INSTANTIATE_TEXT_MATRIX(T) \
+    template bool matfile::parseNumber<T>(const char*, const char*, T&); \
+    template void matfile::TextMatrixReader::read<T>(T*, size_t); \
+    template void matfile::TextMatrixReader::readAll<T>(T*, size_t, unsigned);
+
+INSTANTIATE_TEXT_MATRIX(float)
+INSTANTIATE_TEXT_MATRIX(double)
+INSTANTIATE_TEXT_MATRIX(int32_t)
+INSTANTIATE_TEXT_MATRIX(int64_t)
@@ -0,0 +1,45 @@
+#ifndef MTP_LAB1_TEXTMATRIX_H
+#define MTP_LAB1_TEXTMATRIX_H
+
+#include <cstddef>
+#include <string>
+#include "MappedFile.h"
+
+
+// Text matrix files: whitespace-separated numbers in row-major order, usually one
+// matrix row per line. Numbers are parsed from the mapped file without streams and
+// locales; exact integers and short decimals take a fast path, the rest is left to strtod().
+namespace matfile {
+
+// Parses the whole token [begin, end) as a number of type T, false if it is not one
+template <class T>
+bool parseNumber(const char *begin, const char *end, T &value);
+
+
+class TextMatrixReader {
+
+public:
+
+    // throws std::runtime_error if the file cannot be opened
+    explicit TextMatrixReader(const std::string &path);
+
+    // Parses the next n numbers of the file into dst. Throws std::runtime_error
+    // for malformed numbers and when the file ends earlier.
+    template <class T>
+    void read(T *dst, size_t n);
+
+    // Parses the first n numbers of the file into dst, splitting the file between
+    // up to nThreads threads; errors are reported as by read()
+    template <class T>
+    void readAll(T *dst, size_t n, unsigned nThreads);
+
+private:
+    MappedFile _file;
+    const char *_pos;
+    size_t _nRead;
+
+};
+
+}
+
+#endif //MTP_LAB1_TEXTMATRIX_H
@@ -0,0 +1,92 @@
+#include "TiledMatrixFile.h"
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+
+void readAll(int fd, char *dst, size_t size, size_t offset, const std::string &path) {
+    while (size > 0) {
+        ssize_t n = pread(fd, dst, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Cannot read " + path);
+        dst += n;
+        size -= (size_t)n;
+        offset += (size_t)n;
+    }
+}
+
+void writeAll(int fd, const char *src, size_t size, size_t offset, const std::string &path) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, src, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Cannot write " + path);
+        src += n;
+        size -= (size_t)n;
+        offset += (size_t)n;
+    }
+}
+
+}
+
+
+matfile::TiledMatrixFile::TiledMatrixFile(const std::string &path, size_t nRows, size_t nCols,
+                                          size_t tileSize, DType dtype)
+        : _path(path), _header(makeHeader(nRows, nCols, dtype, 0)) {
+    _header.layout = TILED;
+    _header.tileSize = (uint32_t)tileSize;
+    _fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (_fd < 0) throw std::runtime_error("Cannot create " + path);
+    try {
+        writeAll(_fd, reinterpret_cast<const char*>(&_header), sizeof(_header), 0, _path);
+        // tiles not written yet read as zeros
+        if (ftruncate(_fd, (off_t)getTileOffset(getNTileRows(), 0)) != 0) {
+            throw std::runtime_error("Cannot allocate " + path);
+        }
+    } catch (const std::runtime_error&) {
+        close(_fd);
+        throw;
+    }
+}
+
+matfile::TiledMatrixFile::TiledMatrixFile(const std::string &path)
+        : _path(path) {
+    _fd = open(path.c_str(), O_RDWR);
+    if (_fd < 0) throw std::runtime_error("Cannot open " + path);
+    try {
+        readAll(_fd, reinterpret_cast<char*>(&_header), sizeof(_header), 0, _path);
+        if (_header.layout != TILED || _header.tileSize == 0 || dtypeSize(getDType()) == 0) {
+            throw std::runtime_error(path + " is not a tiled matrix file");
+        }
+    } catch (const std::runtime_error&) {
+        close(_fd);
+        throw;
+    }
+}
+
+matfile::TiledMatrixFile::~TiledMatrixFile() {
+    close(_fd);
+}
+
+size_t matfile::TiledMatrixFile::getTileOffset(size_t tileRow, size_t tileCol) const {
+    return sizeof(Header) + (tileRow*getNTileCols() + tileCol)*getTileBytes();
+}
+
+void matfile::TiledMatrixFile::readTile(size_t tileRow, size_t tileCol, void *dst) const {
+    readAll(_fd, static_cast<char*>(dst), getTileBytes(), getTileOffset(tileRow, tileCol), _path);
+}
+
+void matfile::TiledMatrixFile::writeTile(size_t tileRow, size_t tileCol, const void *src) {
+    writeAll(_fd, static_cast<const char*>(src), getTileBytes(), getTileOffset(tileRow, tileCol), _path);
+}
+
+void matfile::TiledMatrixFile::prefetchTile(size_t tileRow, size_t tileCol) const {
+    posix_fadvise(_fd, (off_t)getTileOffset(tileRow, tileCol), (off_t)getTileBytes(), POSIX_FADV_WILLNEED);
+}
+
+void matfile::TiledMatrixFile::remove() {
+    std::remove(_path.c_str());
+}
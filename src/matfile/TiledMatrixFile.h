@@ -0,0 +1,59 @@
+#ifndef MTP_LAB1_TILEDMATRIXFILE_H
+#define MTP_LAB1_TILEDMATRIXFILE_H
+
+#include <cstddef>
+#include <string>
+#include "MatrixFile.h"
+
+
+namespace matfile {
+
+// Binary matrix file in TILED layout: square tiles of tileSize x tileSize elements follow
+// the header in row-major order of tiles, each tile is row-major itself and padded with
+// zeros beyond the edges of the matrix. Tiles are read and written directly with
+// pread()/pwrite(), so that only the tiles in use occupy memory. Tiles are written
+// in any order, hence the checksum of tiled files is not maintained and is always 0.
+// Throws std::runtime_error on I/O errors.
+class TiledMatrixFile {
+
+public:
+
+    // creates a file of zero tiles
+    TiledMatrixFile(const std::string &path, size_t nRows, size_t nCols, size_t tileSize, DType dtype);
+    // opens an existing tiled file
+    explicit TiledMatrixFile(const std::string &path);
+    ~TiledMatrixFile();
+
+    TiledMatrixFile(const TiledMatrixFile&) = delete;
+    TiledMatrixFile& operator=(const TiledMatrixFile&) = delete;
+
+    const std::string& getPath() const { return _path; }
+    size_t getNRows() const { return _header.nRows; }
+    size_t getNCols() const { return _header.nCols; }
+    DType getDType() const { return DType(_header.dtype); }
+    size_t getTileSize() const { return _header.tileSize; }
+    size_t getNTileRows() const { return (getNRows() + getTileSize() - 1) / getTileSize(); }
+    size_t getNTileCols() const { return (getNCols() + getTileSize() - 1) / getTileSize(); }
+    // size of a tile in bytes
+    size_t getTileBytes() const { return getTileSize()*getTileSize()*dtypeSize(getDType()); }
+
+    void readTile(size_t tileRow, size_t tileCol, void *dst) const;
+    void writeTile(size_t tileRow, size_t tileCol, const void *src);
+    // asks the kernel to start reading the tile in background
+    void prefetchTile(size_t tileRow, size_t tileCol) const;
+
+    // removes the file from disk, it stays usable until closed
+    void remove();
+
+private:
+    std::string _path;
+    Header _header;
+    int _fd;
+
+    size_t getTileOffset(size_t tileRow, size_t tileCol) const;
+
+};
+
+}
+
+#endif //MTP_LAB1_TILEDMATRIXFILE_H
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <limits>
+#include "../cli-args/Parser.h"
+#include "MatrixFile.h"
+
+
+// Reads whitespace-separated text, one matrix row per line
+template <class T>
+void textToBinary(const std::string &inName, const std::string &outName, matfile::DType dtype) {
+    std::ifstream in{inName};
+    if (!in) throw std::runtime_error("Cannot open " + inName);
+    std::vector<T> data;
+    size_t nRows = 0, nCols = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ss{line};
+        size_t rowSize = 0;
+        T value;
+        while (ss >> value) {
+            data.push_back(value);
+            rowSize++;
+        }
+        if (!ss.eof()) throw std::runtime_error("Bad number in row " + std::to_string(nRows + 1));
+        if (rowSize == 0) continue;
+        if (nRows > 0 && rowSize != nCols) {
+            throw std::runtime_error("Row " + std::to_string(nRows + 1) + " has "
+                                     + std::to_string(rowSize) + " elements instead of "
+                                     + std::to_string(nCols));
+        }
+        nCols = rowSize;
+        nRows++;
+    }
+    matfile::writeMatrixFile(outName, nRows, nCols, dtype, data.data());
+    std::cout << nRows << 'x' << nCols << ' ' << matfile::dtypeName(dtype) << std::endl;
+}
+
+template <class T>
+void binaryToText(const matfile::MappedMatrix &matrix, const std::string &outName) {
+    std::ofstream out{outName};
+    out.precision(std::numeric_limits<T>::max_digits10);
+    const T *data = matrix.as<T>();
+    for (size_t row = 0; row < matrix.getNRows(); row++) {
+        for (size_t col = 0; col < matrix.getNCols(); col++) {
+            out << data[row*matrix.getNCols() + col] << ' ';
+        }
+        out << '\n';
+    }
+    out.close();
+    if (!out) throw std::runtime_error("Cannot write " + outName);
+}
+
+
+int main(int argc, char **argv) {
+    cli::Parser parser{"matconvert", "Converts matrices between text and binary formats, "
+                                     "the direction is detected from the input file"};
+    parser  .param("dtype", "-t", "?", "Element type of binary output: float (default), double, int32 or int64")
+            .flag("verify", "-v", "Verify the checksum of binary input")
+            .positional("in-name", "", "Input file")
+            .positional("out-name", "", "Output file");
+    auto args = parser.parse(argc, argv);
+    const std::string &inName = args.param("in-name");
+    const std::string &outName = args.param("out-name");
+
+    try {
+        if (matfile::isMatrixFile(inName)) {
+            matfile::MappedMatrix matrix{inName};
+            if (args.flag("verify") && !matrix.verifyChecksum()) {
+                std::cout << "Checksum mismatch in " << inName << std::endl;
+                return 1;
+            }
+            switch (matrix.getDType()) {
+                case matfile::FLOAT32: binaryToText<float>(matrix, outName); break;
+                case matfile::FLOAT64: binaryToText<double>(matrix, outName); break;
+                case matfile::INT32:   binaryToText<int32_t>(matrix, outName); break;
+                case matfile::INT64:   binaryToText<int64_t>(matrix, outName); break;
+            }
+        } else {
+            matfile::DType dtype = matfile::FLOAT32;
+            if (args.hasParam("dtype") && !matfile::parseDType(args.param("dtype"), dtype)) {
+                parser.fail("dtype", "Unknown element type", true);
+            }
+            switch (dtype) {
+                case matfile::FLOAT32: textToBinary<float>(inName, outName, dtype); break;
+                case matfile::FLOAT64: textToBinary<double>(inName, outName, dtype); break;
+                case matfile::INT32:   textToBinary<int32_t>(inName, outName, dtype); break;
+                case matfile::INT64:   textToBinary<int64_t>(inName, outName, dtype); break;
+            }
+        }
+    } catch (const std::runtime_error &err) {
+        std::cout << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
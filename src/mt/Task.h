@@ -2,6 +2,8 @@
 #define MTP_LAB1_JOB_H
 
 #include <vector>
+#include <string>
+#include <cstddef>
 #include <functional>
 #include <mutex>
 
@@ -11,6 +13,8 @@ class Task {
 
 public:
 
+    virtual ~Task() {}
+
     bool setId(int id) {
         if (!idWasSet) {
             this->id = id;
@@ -44,6 +48,17 @@ public:
     }
     virtual bool isWaiting() = 0;
 
+    // Estimate of memory held by the task from its start until its resources
+    // are deallocated, used by TaskGraph to keep within its memory budget
+    virtual size_t getMemoryUsage() const { return 0; }
+
+    // Tasks with equal non-empty signatures compute the same from the same dependencies,
+    // see TaskGraph::addShared(); empty for tasks which must run every time they are added
+    virtual std::string getSignature() const { return ""; }
+
+    // called by TaskGraph when the task is added, before the graph runs
+    virtual void onAdded(const std::vector<Task*> &dependencies) {}
+
     bool isDone() const {
         std::unique_lock<std::mutex> _lock{_doneMtx};
         return _done;
@@ -27,6 +27,26 @@ void mt::TaskGraph::addTask(mt::Task *task, const std::vector<Task *> &dependenc
     for (auto dep : dependencies) ids.push_back(dep->getId());
     task->setId(_tasks.size());
     _tasks.push_back({task, ids});
+    task->onAdded(dependencies);
+}
+
+mt::Task* mt::TaskGraph::_addShared(Task *task, const std::vector<Task*> &dependencies) {
+    std::string signature = task->getSignature();
+    if (signature.empty()) {
+        addTask(task, dependencies);
+        return task;
+    }
+    std::vector<int> ids;
+    for (auto dep : dependencies) ids.push_back(dep->getId());
+    auto key = std::make_pair(signature, ids);
+    auto it = _shared.find(key);
+    if (it != _shared.end()) {
+        delete task;
+        return it->second;
+    }
+    addTask(task, dependencies);
+    _shared[key] = task;
+    return task;
 }
 
 void mt::TaskGraph::runAll(unsigned nThreads) {
@@ -42,14 +62,7 @@ void mt::TaskGraph::runAll(unsigned nThreads) {
     }
 #endif
 
-    // initialize all states:
-    for(auto &state : _tasks) state.reset();
-    for(const auto &state : _tasks) {
-        for(int depId : state.dependencies) {
-            _tasks[depId].nUsersNotFinished++;
-        }
-    }
-
+    _resetStates();
     std::vector<std::thread> workers;
     for(int i = 1; i < nThreads; i++) {
         workers.push_back(std::thread{&TaskGraph::_workerThread, this});
@@ -61,6 +74,27 @@ void mt::TaskGraph::runAll(unsigned nThreads) {
     }
 }
 
+void mt::TaskGraph::runAll(WorkerPool &pool) {
+    _resetStates();
+    pool.runOnAll([this] { _workerThread(); });
+}
+
+void mt::TaskGraph::deleteTasks() {
+    for (auto &state : _tasks) delete state.task;
+    _tasks.clear();
+    _shared.clear();
+}
+
+void mt::TaskGraph::_resetStates() {
+    for(auto &state : _tasks) state.reset();
+    _memoryInUse = 0;
+    for(const auto &state : _tasks) {
+        for(int depId : state.dependencies) {
+            _tasks[depId].nUsersNotFinished++;
+        }
+    }
+}
+
 void mt::TaskGraph::_workerThread() {
     while(true) {
         int taskId = _startNextPortion();
@@ -100,17 +134,12 @@ int mt::TaskGraph::_startNextPortion() {
         }
 
         // maybe we can start a new task?
-        for (int i = 0; i < _tasks.size(); i++) {
-            const auto &state = _tasks[i];
-            if (state.started==NO && state.nDependenciesNotStarted == 0) {
-                taskId = i;
-                tg_debug("will start task: " << taskId );
-                break;
-            }
-        }
+        taskId = _getTaskToStart();
         if (taskId >= 0) {
+            tg_debug("will start task: " << taskId );
             // we are about to start a new task:
             auto &state = _tasks[taskId];
+            _memoryInUse += state.task->getMemoryUsage();
             // remember that this task is started and runs:
             state.started = WILL_NOW;
             state.runsNow = true;
@@ -138,7 +167,7 @@ int mt::TaskGraph::_startNextPortion() {
         // not all tasks are done, but we cannot start a new task
         // so we have no way than to wait until some task will not be able to start
         _hasReadyTasks.wait(_lock, [this] {
-            return this->_areAllFinished() || (this->_getNReadyTasks()>0);
+            return this->_areAllFinished() || (this->_getTaskToStart() >= 0);
         });
     }
     return -1;
@@ -160,6 +189,7 @@ void mt::TaskGraph::_portionDone(int taskId, bool done) {
             if (dep.finished && dep.nUsersNotFinished == 0) {
                 dep.task->deallocateResources();
                 dep.deallocated = true;
+                _memoryInUse -= dep.task->getMemoryUsage();
             }
         }
 
@@ -168,6 +198,7 @@ void mt::TaskGraph::_portionDone(int taskId, bool done) {
         if (state.nUsersNotFinished == 0) {
             state.task->deallocateResources();
             state.deallocated = true;
+            _memoryInUse -= state.task->getMemoryUsage();
         }
 
         // notify waiting threads, maybe all tasks are finished
@@ -202,14 +233,24 @@ bool mt::TaskGraph::_callStartIfNeeded(int taskId) {
     return canGoNow;
 }
 
-int mt::TaskGraph::_getNReadyTasks() const {
-    int nReady = 0;
-    for (const auto &state : _tasks) {
-        if (state.started==NO && state.nDependenciesNotStarted==0) {
-            nReady++;
+int mt::TaskGraph::_getTaskToStart() const {
+    int taskId = -1;
+    bool anyRuns = false;
+    for (int i = 0; i < _tasks.size(); i++) {
+        const auto &state = _tasks[i];
+        if (taskId < 0 && state.started==NO && state.nDependenciesNotStarted==0) {
+            taskId = i;
         }
+        anyRuns = anyRuns || state.runsNow;
+    }
+    if (taskId < 0) return -1;
+    // over the budget, the task may only be started when no other task runs,
+    // so that the graph still makes progress
+    size_t usage = _tasks[taskId].task->getMemoryUsage();
+    if (anyRuns && (usage > _memoryBudget || _memoryInUse > _memoryBudget - usage)) {
+        return -1;
     }
-    return nReady;
+    return taskId;
 }
 
 bool mt::TaskGraph::_areAllFinished() const {
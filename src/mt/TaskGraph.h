@@ -2,8 +2,12 @@
 #define MTP_LAB1_TASKGRAPH_H
 
 #include <vector>
+#include <map>
+#include <string>
 #include <condition_variable>
+#include <limits>
 #include "Task.h"
+#include "WorkerPool.h"
 
 
 namespace mt {
@@ -15,7 +19,24 @@ public:
     TaskGraph();
 
     void addTask(Task* task, const std::vector<Task*> &dependencies);
+    // Same, unless the graph already has a task with the same signature and dependencies:
+    // then `task` is deleted and that one is returned, so that it is computed once.
+    // For graphs owning tasks created with new.
+    template <class T>
+    T* addShared(T* task, const std::vector<Task*> &dependencies) {
+        return static_cast<T*>(_addShared(task, dependencies));
+    }
     void runAll(unsigned nThreads);
+    // same on the threads of a pool, which are not stopped afterwards
+    void runAll(WorkerPool &pool);
+    // Deletes all tasks and forgets them, for graphs owning tasks created with new
+    void deleteTasks();
+
+    // Tasks are started breadth-first as soon as their dependencies are started, while
+    // memory of started tasks fits in the budget. Beyond it, a new task is started only when
+    // nothing else can run, in the order tasks were added, i.e. depth-first for graphs
+    // built recursively. Unlimited by default.
+    void setMemoryBudget(size_t bytes) { _memoryBudget = bytes; }
 
 private:
 
@@ -67,6 +88,11 @@ private:
         }
     };
 
+    // tasks added by addShared() by their signatures and dependencies
+    std::map<std::pair<std::string, std::vector<int>>, Task*> _shared;
+
+    Task* _addShared(Task* task, const std::vector<Task*> &dependencies);
+    void _resetStates();
     void _workerThread();
     int _startNextPortion();
     void _portionDone(int taskId, bool done);
@@ -76,8 +102,13 @@ private:
     std::mutex _mtxTasks;
     std::condition_variable _hasReadyTasks;
 
-    int _getNReadyTasks() const;
+    size_t _memoryBudget = std::numeric_limits<size_t>::max();
+    // memory of started tasks which were not deallocated yet
+    size_t _memoryInUse = 0;
+
     bool _areAllFinished() const;
+    // first ready task in the order of adding, if it may be started now, otherwise -1
+    int _getTaskToStart() const;
 
 };
 
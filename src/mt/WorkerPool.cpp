@@ -0,0 +1,46 @@
+#include "WorkerPool.h"
+
+
+mt::WorkerPool::WorkerPool(unsigned nThreads) {
+    for (unsigned i = 1; i < nThreads; i++) {
+        _threads.push_back(std::thread{&WorkerPool::_workerThread, this});
+    }
+}
+
+mt::WorkerPool::~WorkerPool() {
+    {
+        std::unique_lock<std::mutex> _lock{_mtx};
+        _stopping = true;
+        _changed.notify_all();
+    }
+    for (auto &thread : _threads) thread.join();
+}
+
+void mt::WorkerPool::runOnAll(const std::function<void()> &f) {
+    {
+        std::unique_lock<std::mutex> _lock{_mtx};
+        _job = f;
+        _nBusy = (unsigned)_threads.size();
+        _generation++;
+        _changed.notify_all();
+    }
+    f();
+    std::unique_lock<std::mutex> _lock{_mtx};
+    _changed.wait(_lock, [this] { return _nBusy == 0; });
+    _job = nullptr;
+}
+
+void mt::WorkerPool::_workerThread() {
+    unsigned long generation = 0;
+    std::unique_lock<std::mutex> _lock{_mtx};
+    while (true) {
+        _changed.wait(_lock, [&] { return _stopping || _generation != generation; });
+        if (_stopping) return;
+        generation = _generation;
+        std::function<void()> job = _job;
+        _lock.unlock();
+        job();
+        _lock.lock();
+        if (--_nBusy == 0) _changed.notify_all();
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef MTP_LAB1_WORKERPOOL_H
+#define MTP_LAB1_WORKERPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+namespace mt {
+
+// Threads kept alive between runs of task graphs, see TaskGraph::runAll(WorkerPool&).
+// The thread calling runOnAll() is one of the workers, so nThreads - 1 are spawned.
+class WorkerPool {
+
+public:
+
+    explicit WorkerPool(unsigned nThreads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned getNThreads() const { return (unsigned)_threads.size() + 1; }
+
+    // calls f on every worker, returns when all calls are done
+    void runOnAll(const std::function<void()> &f);
+
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _mtx;
+    std::condition_variable _changed;
+    std::function<void()> _job;
+    // incremented for every job, so that each thread runs it once
+    unsigned long _generation = 0;
+    unsigned _nBusy = 0;
+    bool _stopping = false;
+
+    void _workerThread();
+
+};
+
+}
+
+#endif //MTP_LAB1_WORKERPOOL_H